@@ -0,0 +1,342 @@
+#include "bvh.h"
+#include "math3d.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+struct BuildTask
+{
+    uint32_t node;
+    uint32_t first;
+    uint32_t count;
+    int depth;
+};
+
+// Per facet bounds and centroid, computed once; the build only reorders
+// facet ids
+struct BuildPrimitive
+{
+    float boundsMin[3];
+    float boundsMax[3];
+    float centroid[3];
+};
+
+static void getPrimitiveBounds(const struct BuildPrimitive* primitives, const uint32_t* ids, uint32_t first,
+                               uint32_t count, float boundsMin[3], float boundsMax[3])
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        boundsMin[k] = INFINITY;
+        boundsMax[k] = -INFINITY;
+    }
+    for (uint32_t t = first; t < first + count; ++t)
+    {
+        const struct BuildPrimitive* primitive = &primitives[ids[t]];
+        for (int k = 0; k < 3; ++k)
+        {
+            if (primitive->boundsMin[k] < boundsMin[k]) boundsMin[k] = primitive->boundsMin[k];
+            if (primitive->boundsMax[k] > boundsMax[k]) boundsMax[k] = primitive->boundsMax[k];
+        }
+    }
+}
+
+// Splits at the middle of the centroid bounds along their longest axis, or
+// in half by count when all centroids land on one side
+static uint32_t partitionPrimitives(const struct BuildPrimitive* primitives, uint32_t* ids, uint32_t first,
+                                    uint32_t count)
+{
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (uint32_t t = first; t < first + count; ++t)
+    {
+        const float* c = primitives[ids[t]].centroid;
+        for (int k = 0; k < 3; ++k)
+        {
+            if (c[k] < lo[k]) lo[k] = c[k];
+            if (c[k] > hi[k]) hi[k] = c[k];
+        }
+    }
+    int axis = 0;
+    if (hi[1] - lo[1] > hi[axis] - lo[axis]) axis = 1;
+    if (hi[2] - lo[2] > hi[axis] - lo[axis]) axis = 2;
+    float split = 0.5f * (lo[axis] + hi[axis]);
+
+    uint32_t i = first, j = first + count;
+    while (i < j)
+    {
+        if (primitives[ids[i]].centroid[axis] < split)
+        {
+            i++;
+            continue;
+        }
+        j--;
+        uint32_t id = ids[i];
+        ids[i] = ids[j];
+        ids[j] = id;
+    }
+    uint32_t leftCount = i - first;
+    if (leftCount == 0 || leftCount == count)
+        leftCount = count / 2;
+    return leftCount;
+}
+
+uint32_t buildMeshBVH(const struct STLMapping* stl, struct MeshBVH* bvh)
+{
+    memset(bvh, 0, sizeof(*bvh));
+    uint32_t n = stl->numTriangles;
+    if (n == 0)
+        return 0;
+
+    // a binary tree with at least one triangle per leaf
+    bvh->nodes = (struct BVHNode*)malloc((size_t)(2 * n - 1) * sizeof(struct BVHNode));
+    bvh->triangles = (struct BVHTriangle*)malloc((size_t)n * sizeof(struct BVHTriangle));
+    bvh->facetIds = (uint32_t*)malloc((size_t)n * sizeof(uint32_t));
+    struct BuildPrimitive* primitives = (struct BuildPrimitive*)malloc((size_t)n * sizeof(struct BuildPrimitive));
+    if (!bvh->nodes || !bvh->triangles || !bvh->facetIds || !primitives)
+    {
+        perror("Failed to allocate memory");
+        free(primitives);
+        freeMeshBVH(bvh);
+        return 0;
+    }
+    for (uint32_t t = 0; t < n; ++t)
+    {
+        struct BuildPrimitive* primitive = &primitives[t];
+        for (int k = 0; k < 3; ++k)
+        {
+            float a = stlFacetVertex(stl, t, 0)[k], b = stlFacetVertex(stl, t, 1)[k], c = stlFacetVertex(stl, t, 2)[k];
+            primitive->boundsMin[k] = fminf(a, fminf(b, c));
+            primitive->boundsMax[k] = fmaxf(a, fmaxf(b, c));
+            primitive->centroid[k] = (a + b + c) * (1.0f / 3.0f);
+        }
+        bvh->facetIds[t] = t;
+    }
+    bvh->numTriangles = n;
+
+    // children are allocated in pairs; depth first keeps the stack at one
+    // pending sibling per level
+    struct BuildTask stack[BVH_MAX_DEPTH + 1];
+    int top = 0;
+    stack[top++] = { 0, 0, n, 0 };
+    bvh->numNodes = 1;
+    while (top > 0)
+    {
+        struct BuildTask task = stack[--top];
+        struct BVHNode* node = &bvh->nodes[task.node];
+        getPrimitiveBounds(primitives, bvh->facetIds, task.first, task.count, node->boundsMin, node->boundsMax);
+        if (task.count <= BVH_LEAF_SIZE || task.depth >= BVH_MAX_DEPTH)
+        {
+            node->first = task.first;
+            node->count = task.count;
+            continue;
+        }
+        uint32_t leftCount = partitionPrimitives(primitives, bvh->facetIds, task.first, task.count);
+        uint32_t left = bvh->numNodes;
+        bvh->numNodes += 2;
+        node->first = left;
+        node->count = 0;
+        stack[top++] = { left + 1, task.first + leftCount, task.count - leftCount, task.depth + 1 };
+        stack[top++] = { left, task.first, leftCount, task.depth + 1 };
+    }
+    free(primitives);
+    bvh->nodes = (struct BVHNode*)realloc(bvh->nodes, bvh->numNodes * sizeof(struct BVHNode));
+
+    // leaf order copies, so a leaf reads one contiguous run
+    for (uint32_t t = 0; t < n; ++t)
+    {
+        for (int v = 0; v < 3; ++v)
+            memcpy(bvh->triangles[t].v[v], stlFacetVertex(stl, bvh->facetIds[t], v), sizeof(float) * 3);
+    }
+    return bvh->numNodes;
+}
+
+void freeMeshBVH(struct MeshBVH* bvh)
+{
+    free(bvh->nodes);
+    free(bvh->triangles);
+    free(bvh->facetIds);
+    memset(bvh, 0, sizeof(*bvh));
+}
+
+void closestPointOnTriangle(const float p[3], const float a[3], const float b[3], const float c[3],
+                            float closest[3])
+{
+    M3DVector3f ab, ac, ap;
+    m3dSubtractVectors3(ab, b, a);
+    m3dSubtractVectors3(ac, c, a);
+    m3dSubtractVectors3(ap, p, a);
+    float d1 = m3dDotProduct(ab, ap), d2 = m3dDotProduct(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    {
+        m3dCopyVector3(closest, a);
+        return;
+    }
+
+    M3DVector3f bp;
+    m3dSubtractVectors3(bp, p, b);
+    float d3 = m3dDotProduct(ab, bp), d4 = m3dDotProduct(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+    {
+        m3dCopyVector3(closest, b);
+        return;
+    }
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        float v = d1 / (d1 - d3);
+        for (int k = 0; k < 3; ++k)
+            closest[k] = a[k] + v * ab[k];
+        return;
+    }
+
+    M3DVector3f cp;
+    m3dSubtractVectors3(cp, p, c);
+    float d5 = m3dDotProduct(ab, cp), d6 = m3dDotProduct(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+    {
+        m3dCopyVector3(closest, c);
+        return;
+    }
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    {
+        float w = d2 / (d2 - d6);
+        for (int k = 0; k < 3; ++k)
+            closest[k] = a[k] + w * ac[k];
+        return;
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    {
+        float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        for (int k = 0; k < 3; ++k)
+            closest[k] = b[k] + w * (c[k] - b[k]);
+        return;
+    }
+
+    float denom = 1.0f / (va + vb + vc);
+    float v = vb * denom, w = vc * denom;
+    for (int k = 0; k < 3; ++k)
+        closest[k] = a[k] + ab[k] * v + ac[k] * w;
+}
+
+static inline float getBoxDistanceSquared(const struct BVHNode* node, const float p[3])
+{
+    float d2 = 0.0f;
+    for (int k = 0; k < 3; ++k)
+    {
+        float d = fmaxf(fmaxf(node->boundsMin[k] - p[k], p[k] - node->boundsMax[k]), 0.0f);
+        d2 += d * d;
+    }
+    return d2;
+}
+
+int findClosestFacet(const struct MeshBVH* bvh, const float center[3], float radius,
+                     uint32_t* facet, float* distance, float point[3])
+{
+    if (bvh->numNodes == 0)
+        return 0;
+
+    // the search radius shrinks to the best facet found so far
+    float best2 = radius * radius;
+    uint32_t bestTriangle = UINT32_MAX;
+    uint32_t stack[BVH_MAX_DEPTH + 1];
+    int top = 0;
+    if (getBoxDistanceSquared(&bvh->nodes[0], center) <= best2)
+        stack[top++] = 0;
+
+    while (top > 0)
+    {
+        const struct BVHNode* node = &bvh->nodes[stack[--top]];
+        if (getBoxDistanceSquared(node, center) > best2)
+            continue;
+        if (node->count > 0)
+        {
+            for (uint32_t t = node->first; t < node->first + node->count; ++t)
+            {
+                const struct BVHTriangle* triangle = &bvh->triangles[t];
+                M3DVector3f closest, d;
+                closestPointOnTriangle(center, triangle->v[0], triangle->v[1], triangle->v[2], closest);
+                m3dSubtractVectors3(d, center, closest);
+                float d2 = m3dDotProduct(d, d);
+                if (d2 <= best2)
+                {
+                    best2 = d2;
+                    bestTriangle = t;
+                    m3dCopyVector3(point, closest);
+                }
+            }
+            continue;
+        }
+
+        // nearer child on top so it is visited first
+        uint32_t near = node->first, far = node->first + 1;
+        float nearD2 = getBoxDistanceSquared(&bvh->nodes[near], center);
+        float farD2 = getBoxDistanceSquared(&bvh->nodes[far], center);
+        if (farD2 < nearD2)
+        {
+            uint32_t swap = near; near = far; far = swap;
+            float swapD2 = nearD2; nearD2 = farD2; farD2 = swapD2;
+        }
+        if (farD2 <= best2)
+            stack[top++] = far;
+        if (nearD2 <= best2)
+            stack[top++] = near;
+    }
+
+    if (bestTriangle == UINT32_MAX)
+        return 0;
+    *facet = bvh->facetIds[bestTriangle];
+    *distance = sqrtf(best2);
+    return 1;
+}
+
+uint32_t countRayCrossings(const struct MeshBVH* bvh, const float origin[3], int axis)
+{
+    if (bvh->numNodes == 0)
+        return 0;
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    uint32_t crossings = 0;
+    uint32_t stack[BVH_MAX_DEPTH + 1];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const struct BVHNode* node = &bvh->nodes[stack[--top]];
+        // the ray is a line in u, v and a half line along the axis
+        if (origin[u] < node->boundsMin[u] || origin[u] > node->boundsMax[u] ||
+            origin[v] < node->boundsMin[v] || origin[v] > node->boundsMax[v] ||
+            origin[axis] > node->boundsMax[axis])
+            continue;
+        if (node->count == 0)
+        {
+            stack[top++] = node->first;
+            stack[top++] = node->first + 1;
+            continue;
+        }
+        for (uint32_t t = node->first; t < node->first + node->count; ++t)
+        {
+            const float (*p)[3] = bvh->triangles[t].v;
+            // barycentric coordinates of the ray in the u, v projection
+            float e0 = (p[1][u] - origin[u]) * (p[2][v] - origin[v]) - (p[2][u] - origin[u]) * (p[1][v] - origin[v]);
+            float e1 = (p[2][u] - origin[u]) * (p[0][v] - origin[v]) - (p[0][u] - origin[u]) * (p[2][v] - origin[v]);
+            float e2 = (p[0][u] - origin[u]) * (p[1][v] - origin[v]) - (p[1][u] - origin[u]) * (p[0][v] - origin[v]);
+            // a ray exactly through a shared edge counts for both facets
+            bool positive = e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f;
+            bool negative = e0 <= 0.0f && e1 <= 0.0f && e2 <= 0.0f;
+            if (!positive && !negative)
+                continue;
+            float sum = e0 + e1 + e2;
+            if (sum == 0.0f)
+                continue;
+            float hit = (e0 * p[0][axis] + e1 * p[1][axis] + e2 * p[2][axis]) / sum;
+            if (hit > origin[axis])
+                crossings++;
+        }
+    }
+    return crossings;
+}
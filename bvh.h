@@ -0,0 +1,53 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdint.h>
+#include "readstl.h"
+
+// Axis-aligned bounding volume hierarchy over the facets of one STL mesh,
+// in the mesh's own frame. Nodes are stored depth first: an interior node's
+// children are at first and first + 1, a leaf covers count triangles
+// starting at first.
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+
+struct BVHNode
+{
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t first;
+    uint32_t count;         // 0 for interior nodes
+};
+
+struct BVHTriangle
+{
+    float v[3][3];
+};
+
+struct MeshBVH
+{
+    uint32_t numNodes;
+    struct BVHNode* nodes;
+    uint32_t numTriangles;
+    struct BVHTriangle* triangles;  // copies, in leaf order
+    uint32_t* facetIds;             // STL facet index of each triangle
+};
+
+// Returns the number of nodes, 0 on failure or for an empty mesh
+uint32_t buildMeshBVH(const struct STLMapping* stl, struct MeshBVH* bvh);
+void freeMeshBVH(struct MeshBVH* bvh);
+
+// Closest point of a triangle to p (Ericson, Real-Time Collision Detection 5.1.5)
+void closestPointOnTriangle(const float p[3], const float a[3], const float b[3], const float c[3],
+                            float closest[3]);
+
+// Finds the facet closest to center among those within radius. Returns 1 and
+// fills facet, distance and point (on the facet) if there is one.
+int findClosestFacet(const struct MeshBVH* bvh, const float center[3], float radius,
+                     uint32_t* facet, float* distance, float point[3]);
+
+// Number of facets crossed by the ray from origin along +axis (0, 1, 2).
+// Odd means inside a closed mesh.
+uint32_t countRayCrossings(const struct MeshBVH* bvh, const float origin[3], int axis);
+
+#endif
@@ -0,0 +1,635 @@
+#include "collision.h"
+
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int findArmSphereContact(const struct MeshBVH linkBVHs[NUM_LINKS], struct KinematicChain* chain,
+                         const float center[3], float radius, struct ArmContact* contact)
+{
+    int found = 0;
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        const float* m = getLinkMatrix(chain, i);
+        M3DVector3f localCenter, localPoint;
+        m3dInverseTransformVector3(localCenter, center, m);
+        uint32_t facet;
+        float distance;
+        // later links only count if they are closer
+        float searchRadius = found ? contact->distance : radius;
+        if (!findClosestFacet(&linkBVHs[i], localCenter, searchRadius, &facet, &distance, localPoint))
+            continue;
+        found = 1;
+        contact->link = i;
+        contact->facet = facet;
+        contact->distance = distance;
+        m3dTransformVector3(contact->point, localPoint, m);
+    }
+    return found;
+}
+
+int findFirstSphereImpact(const struct MeshBVH linkBVHs[NUM_LINKS], const float fromAngles[NUM_LINKS],
+                          const float toAngles[NUM_LINKS], const float center[3], float radius, float tolerance,
+                          float* time, struct ArmContact* contact)
+{
+    // farthest point of each link from its own origin, from the root box
+    float linkRadius[NUM_LINKS];
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        linkRadius[i] = 0.0f;
+        if (linkBVHs[i].numNodes == 0)
+            continue;
+        const struct BVHNode* root = &linkBVHs[i].nodes[0];
+        float farthest2 = 0.0f;
+        for (int k = 0; k < 3; ++k)
+        {
+            float d = fmaxf(fabsf(root->boundsMin[k]), fabsf(root->boundsMax[k]));
+            farthest2 += d * d;
+        }
+        linkRadius[i] = sqrtf(farthest2);
+    }
+
+    // Speed bound per unit t: joint j turns by |to - from| radians and no
+    // point of link i >= j is farther from it than the links in between
+    // plus link i's radius
+    float speed[NUM_LINKS];
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        speed[i] = 0.0f;
+        for (int j = 1; j <= i; ++j)
+        {
+            float reach = linkRadius[i];
+            for (int k = j + 1; k <= i; ++k)
+                reach += m3dGetVectorLength(linkOrigins[k]);
+            speed[i] += fabsf(m3dDegToRad(toAngles[j] - fromAngles[j])) * reach;
+        }
+    }
+
+    float t = 0.0f;
+    float angles[NUM_LINKS];
+    M3DMatrix44f matrices[NUM_LINKS];
+    for (int iteration = 0; iteration < CCD_MAX_ITERATIONS; ++iteration)
+    {
+        for (int j = 0; j < NUM_LINKS; ++j)
+            angles[j] = fromAngles[j] + t * (toAngles[j] - fromAngles[j]);
+        computeLinkMatrices(angles, matrices);
+
+        // the smallest time any link needs to close its gap
+        float step = INFINITY;
+        int closest = -1;
+        uint32_t closestFacet = 0;
+        float closestDistance = INFINITY;
+        M3DVector3f closestPoint;
+        for (int i = 0; i < NUM_LINKS; ++i)
+        {
+            M3DVector3f localCenter, localPoint;
+            m3dInverseTransformVector3(localCenter, center, matrices[i]);
+            uint32_t facet;
+            float distance;
+            if (!findClosestFacet(&linkBVHs[i], localCenter, INFINITY, &facet, &distance, localPoint))
+                continue;
+            if (distance < closestDistance)
+            {
+                closest = i;
+                closestFacet = facet;
+                closestDistance = distance;
+                m3dTransformVector3(closestPoint, localPoint, matrices[i]);
+            }
+            float gap = distance - radius;
+            if (gap <= tolerance)
+            {
+                step = 0.0f;
+                continue;
+            }
+            if (speed[i] > 0.0f)
+                step = fminf(step, gap / speed[i]);
+        }
+        if (closest < 0)
+            return 0;
+        if (step == 0.0f || iteration == CCD_MAX_ITERATIONS - 1)
+        {
+            *time = t;
+            contact->link = closest;
+            contact->facet = closestFacet;
+            contact->distance = closestDistance;
+            m3dCopyVector3(contact->point, closestPoint);
+            return 1;
+        }
+        t += step;
+        if (t > 1.0f)
+            return 0;
+    }
+    return 0;
+}
+
+// Symmetric 3x3 eigenvectors by cyclic Jacobi rotations; columns of vectors
+static void getEigenVectors3(float a[3][3], float vectors[3][3])
+{
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            vectors[r][c] = (r == c) ? 1.0f : 0.0f;
+
+    for (int sweep = 0; sweep < 16; ++sweep)
+    {
+        float off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        if (off < 1e-12f * (a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2]))
+            break;
+        for (int p = 0; p < 2; ++p)
+        {
+            for (int q = p + 1; q < 3; ++q)
+            {
+                if (a[p][q] == 0.0f)
+                    continue;
+                float theta = (a[q][q] - a[p][p]) / (2.0f * a[p][q]);
+                float t = (theta >= 0.0f ? 1.0f : -1.0f) / (fabsf(theta) + sqrtf(theta * theta + 1.0f));
+                float c = 1.0f / sqrtf(t * t + 1.0f), s = t * c;
+                for (int k = 0; k < 3; ++k)
+                {
+                    float akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < 3; ++k)
+                {
+                    float apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < 3; ++k)
+                {
+                    float vkp = vectors[k][p], vkq = vectors[k][q];
+                    vectors[k][p] = c * vkp - s * vkq;
+                    vectors[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+// Bounds of the triangles along the given axes
+static void fitBox(const struct MeshBVH* bvh, const float axes[3][3], struct OrientedBox* box)
+{
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (uint32_t t = 0; t < bvh->numTriangles; ++t)
+    {
+        for (int v = 0; v < 3; ++v)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                float d = m3dDotProduct(bvh->triangles[t].v[v], axes[i]);
+                if (d < lo[i]) lo[i] = d;
+                if (d > hi[i]) hi[i] = d;
+            }
+        }
+    }
+    memcpy(box->axes, axes, sizeof(box->axes));
+    for (int k = 0; k < 3; ++k)
+        box->center[k] = 0.0f;
+    for (int i = 0; i < 3; ++i)
+    {
+        box->halfExtents[i] = 0.5f * (hi[i] - lo[i]);
+        for (int k = 0; k < 3; ++k)
+            box->center[k] += 0.5f * (lo[i] + hi[i]) * axes[i][k];
+    }
+}
+
+void computeMeshOBB(const struct MeshBVH* bvh, struct OrientedBox* box)
+{
+    memset(box, 0, sizeof(*box));
+    uint32_t n = bvh->numTriangles * 3;
+    if (n == 0)
+        return;
+
+    double mean[3] = { 0.0, 0.0, 0.0 };
+    for (uint32_t t = 0; t < bvh->numTriangles; ++t)
+        for (int v = 0; v < 3; ++v)
+            for (int k = 0; k < 3; ++k)
+                mean[k] += bvh->triangles[t].v[v][k];
+    for (int k = 0; k < 3; ++k)
+        mean[k] /= n;
+    double covariance[3][3] = { { 0.0 } };
+    for (uint32_t t = 0; t < bvh->numTriangles; ++t)
+    {
+        for (int v = 0; v < 3; ++v)
+        {
+            double d[3];
+            for (int k = 0; k < 3; ++k)
+                d[k] = bvh->triangles[t].v[v][k] - mean[k];
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 3; ++c)
+                    covariance[r][c] += d[r] * d[c];
+        }
+    }
+    float a[3][3], vectors[3][3];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            a[r][c] = (float)(covariance[r][c] / n);
+    getEigenVectors3(a, vectors);
+
+    float principalAxes[3][3], frameAxes[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    for (int i = 0; i < 3; ++i)
+        for (int k = 0; k < 3; ++k)
+            principalAxes[i][k] = vectors[k][i];
+    m3dCrossProduct(principalAxes[2], principalAxes[0], principalAxes[1]);
+
+    // machined parts are often aligned with their own frame
+    struct OrientedBox frameBox;
+    fitBox(bvh, principalAxes, box);
+    fitBox(bvh, frameAxes, &frameBox);
+    if (frameBox.halfExtents[0] * frameBox.halfExtents[1] * frameBox.halfExtents[2] <=
+        box->halfExtents[0] * box->halfExtents[1] * box->halfExtents[2])
+        *box = frameBox;
+}
+
+int testOBBOverlap(const struct OrientedBox* a, const struct OrientedBox* b)
+{
+    // Ericson, Real-Time Collision Detection 4.4.1, b expressed in a's axes
+    float r[3][3], absR[3][3], t[3];
+    M3DVector3f d;
+    m3dSubtractVectors3(d, b->center, a->center);
+    for (int i = 0; i < 3; ++i)
+    {
+        t[i] = m3dDotProduct(d, a->axes[i]);
+        for (int j = 0; j < 3; ++j)
+        {
+            r[i][j] = m3dDotProduct(a->axes[i], b->axes[j]);
+            // parallel edges give a near zero cross product
+            absR[i][j] = fabsf(r[i][j]) + 1e-6f;
+        }
+    }
+    const float* ea = a->halfExtents;
+    const float* eb = b->halfExtents;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        if (fabsf(t[i]) > ea[i] + eb[0] * absR[i][0] + eb[1] * absR[i][1] + eb[2] * absR[i][2])
+            return 0;
+    }
+    for (int j = 0; j < 3; ++j)
+    {
+        float distance = fabsf(t[0] * r[0][j] + t[1] * r[1][j] + t[2] * r[2][j]);
+        if (distance > ea[0] * absR[0][j] + ea[1] * absR[1][j] + ea[2] * absR[2][j] + eb[j])
+            return 0;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; ++j)
+        {
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            float ra = ea[i1] * absR[i2][j] + ea[i2] * absR[i1][j];
+            float rb = eb[j1] * absR[i][j2] + eb[j2] * absR[i][j1];
+            if (fabsf(t[i2] * r[i1][j] - t[i1] * r[i2][j]) > ra + rb)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+#ifdef __SSE2__
+static inline __m128 absPs(__m128 x)
+{
+    return _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));
+}
+
+// Same tests as testOBBOverlap for four box pairs, one per lane. Returns a
+// bit per overlapping pair.
+static int testOBBOverlap4(const struct OrientedBox* const a[4], const struct OrientedBox* const b[4])
+{
+    __m128 ca[3], cb[3], ua[3][3], ub[3][3], ea[3], eb[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        ca[k] = _mm_setr_ps(a[0]->center[k], a[1]->center[k], a[2]->center[k], a[3]->center[k]);
+        cb[k] = _mm_setr_ps(b[0]->center[k], b[1]->center[k], b[2]->center[k], b[3]->center[k]);
+        ea[k] = _mm_setr_ps(a[0]->halfExtents[k], a[1]->halfExtents[k], a[2]->halfExtents[k], a[3]->halfExtents[k]);
+        eb[k] = _mm_setr_ps(b[0]->halfExtents[k], b[1]->halfExtents[k], b[2]->halfExtents[k], b[3]->halfExtents[k]);
+        for (int i = 0; i < 3; ++i)
+        {
+            ua[i][k] = _mm_setr_ps(a[0]->axes[i][k], a[1]->axes[i][k], a[2]->axes[i][k], a[3]->axes[i][k]);
+            ub[i][k] = _mm_setr_ps(b[0]->axes[i][k], b[1]->axes[i][k], b[2]->axes[i][k], b[3]->axes[i][k]);
+        }
+    }
+
+    __m128 r[3][3], absR[3][3], t[3], d[3];
+    __m128 epsilon = _mm_set1_ps(1e-6f);
+    for (int k = 0; k < 3; ++k)
+        d[k] = _mm_sub_ps(cb[k], ca[k]);
+    for (int i = 0; i < 3; ++i)
+    {
+        t[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], ua[i][0]), _mm_mul_ps(d[1], ua[i][1])),
+                          _mm_mul_ps(d[2], ua[i][2]));
+        for (int j = 0; j < 3; ++j)
+        {
+            r[i][j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ua[i][0], ub[j][0]), _mm_mul_ps(ua[i][1], ub[j][1])),
+                                 _mm_mul_ps(ua[i][2], ub[j][2]));
+            absR[i][j] = _mm_add_ps(absPs(r[i][j]), epsilon);
+        }
+    }
+
+    // lanes stay set while no separating axis has been found
+    __m128 separated = _mm_setzero_ps();
+    for (int i = 0; i < 3; ++i)
+    {
+        __m128 rb = _mm_add_ps(_mm_add_ps(_mm_mul_ps(eb[0], absR[i][0]), _mm_mul_ps(eb[1], absR[i][1])),
+                               _mm_mul_ps(eb[2], absR[i][2]));
+        separated = _mm_or_ps(separated, _mm_cmpgt_ps(absPs(t[i]), _mm_add_ps(ea[i], rb)));
+    }
+    for (int j = 0; j < 3; ++j)
+    {
+        __m128 distance = absPs(_mm_add_ps(_mm_add_ps(_mm_mul_ps(t[0], r[0][j]), _mm_mul_ps(t[1], r[1][j])),
+                                           _mm_mul_ps(t[2], r[2][j])));
+        __m128 ra = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ea[0], absR[0][j]), _mm_mul_ps(ea[1], absR[1][j])),
+                               _mm_mul_ps(ea[2], absR[2][j]));
+        separated = _mm_or_ps(separated, _mm_cmpgt_ps(distance, _mm_add_ps(ra, eb[j])));
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; ++j)
+        {
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            __m128 ra = _mm_add_ps(_mm_mul_ps(ea[i1], absR[i2][j]), _mm_mul_ps(ea[i2], absR[i1][j]));
+            __m128 rb = _mm_add_ps(_mm_mul_ps(eb[j1], absR[i][j2]), _mm_mul_ps(eb[j2], absR[i][j1]));
+            __m128 distance = absPs(_mm_sub_ps(_mm_mul_ps(t[i2], r[i1][j]), _mm_mul_ps(t[i1], r[i2][j])));
+            separated = _mm_or_ps(separated, _mm_cmpgt_ps(distance, _mm_add_ps(ra, rb)));
+        }
+    }
+    return ~_mm_movemask_ps(separated) & 0xF;
+}
+#endif
+
+// Box of a link moved into arm base coordinates
+static void transformBox(const M3DMatrix44f m, const struct OrientedBox* box, struct OrientedBox* result)
+{
+    m3dTransformVector3(result->center, box->center, m);
+    for (int i = 0; i < 3; ++i)
+    {
+        const float* axis = box->axes[i];
+        for (int k = 0; k < 3; ++k)
+            result->axes[i][k] = m[k] * axis[0] + m[4 + k] * axis[1] + m[8 + k] * axis[2];
+    }
+    m3dCopyVector3(result->halfExtents, box->halfExtents);
+}
+
+// Moller-Trumbore, limited to the segment p to q
+static int segmentIntersectsTriangle(const float p[3], const float q[3], const float a[3], const float b[3],
+                                     const float c[3])
+{
+    M3DVector3f direction, ab, ac, h, s, qv;
+    m3dSubtractVectors3(direction, q, p);
+    m3dSubtractVectors3(ab, b, a);
+    m3dSubtractVectors3(ac, c, a);
+    m3dCrossProduct(h, direction, ac);
+    float det = m3dDotProduct(ab, h);
+    // parallel to the plane, relative to the sizes involved
+    if (det * det <= 1e-10f * m3dDotProduct(ab, ab) * m3dDotProduct(h, h))
+        return 0;
+    float inverseDet = 1.0f / det;
+    m3dSubtractVectors3(s, p, a);
+    float u = m3dDotProduct(s, h) * inverseDet;
+    if (u < 0.0f || u > 1.0f)
+        return 0;
+    m3dCrossProduct(qv, s, ab);
+    float v = m3dDotProduct(direction, qv) * inverseDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return 0;
+    float t = m3dDotProduct(ac, qv) * inverseDet;
+    return t >= 0.0f && t <= 1.0f;
+}
+
+// fminf and fmaxf are library calls unless NaNs may be ignored
+static inline float min3(float a, float b, float c)
+{
+    float m = a < b ? a : b;
+    return m < c ? m : c;
+}
+
+static inline float max3(float a, float b, float c)
+{
+    float m = a > b ? a : b;
+    return m > c ? m : c;
+}
+
+// Two non-coplanar triangles intersect when an edge of one crosses the other
+static int trianglesIntersect(const float a[3][3], const float b[3][3])
+{
+    // most leaf pairs are rejected by their bounds
+    for (int k = 0; k < 3; ++k)
+    {
+        if (max3(a[0][k], a[1][k], a[2][k]) < min3(b[0][k], b[1][k], b[2][k]) ||
+            max3(b[0][k], b[1][k], b[2][k]) < min3(a[0][k], a[1][k], a[2][k]))
+            return 0;
+    }
+    for (int e = 0; e < 3; ++e)
+    {
+        if (segmentIntersectsTriangle(a[e], a[(e + 1) % 3], b[0], b[1], b[2]) ||
+            segmentIntersectsTriangle(b[e], b[(e + 1) % 3], a[0], a[1], a[2]))
+            return 1;
+    }
+    return 0;
+}
+
+// Separating axis test between a's node box and b's node box moved into
+// a's frame, as in testOBBOverlap with a's axes the coordinate axes
+static int testNodeOverlap(const struct BVHNode* a, const struct BVHNode* b, const M3DMatrix44f bToA)
+{
+    float ea[3], eb[3], centerB[3], t[3], r[3][3], absR[3][3];
+    for (int k = 0; k < 3; ++k)
+    {
+        ea[k] = 0.5f * (a->boundsMax[k] - a->boundsMin[k]);
+        eb[k] = 0.5f * (b->boundsMax[k] - b->boundsMin[k]);
+        centerB[k] = 0.5f * (b->boundsMin[k] + b->boundsMax[k]);
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        t[i] = bToA[12 + i] + bToA[i] * centerB[0] + bToA[4 + i] * centerB[1] + bToA[8 + i] * centerB[2] -
+               0.5f * (a->boundsMin[i] + a->boundsMax[i]);
+        for (int j = 0; j < 3; ++j)
+        {
+            r[i][j] = bToA[j * 4 + i];
+            absR[i][j] = fabsf(r[i][j]) + 1e-6f;
+        }
+    }
+
+    // a's axes first: this alone is the transformed bounding box test
+    for (int i = 0; i < 3; ++i)
+    {
+        if (fabsf(t[i]) > ea[i] + eb[0] * absR[i][0] + eb[1] * absR[i][1] + eb[2] * absR[i][2])
+            return 0;
+    }
+    for (int j = 0; j < 3; ++j)
+    {
+        float distance = fabsf(t[0] * r[0][j] + t[1] * r[1][j] + t[2] * r[2][j]);
+        if (distance > ea[0] * absR[0][j] + ea[1] * absR[1][j] + ea[2] * absR[2][j] + eb[j])
+            return 0;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; ++j)
+        {
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            float ra = ea[i1] * absR[i2][j] + ea[i2] * absR[i1][j];
+            float rb = eb[j1] * absR[i][j2] + eb[j2] * absR[i][j1];
+            if (fabsf(t[i2] * r[i1][j] - t[i1] * r[i2][j]) > ra + rb)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Simultaneous descent of both trees, b's geometry moved into a's frame
+static int testMeshPair(const struct MeshBVH* a, const struct MeshBVH* b, const M3DMatrix44f bToA)
+{
+    if (a->numNodes == 0 || b->numNodes == 0)
+        return 0;
+    // one pending pair per level of either tree
+    uint32_t stack[BVH_MAX_DEPTH * 2 + 2][2];
+    int top = 0;
+    stack[top][0] = 0;
+    stack[top][1] = 0;
+    top++;
+    while (top > 0)
+    {
+        --top;
+        uint32_t indexA = stack[top][0], indexB = stack[top][1];
+        const struct BVHNode* nodeA = &a->nodes[indexA];
+        const struct BVHNode* nodeB = &b->nodes[indexB];
+        if (!testNodeOverlap(nodeA, nodeB, bToA))
+            continue;
+
+        if (nodeA->count > 0 && nodeB->count > 0)
+        {
+            // leaf triangles are contiguous, transform them in one batch;
+            // leaves cut off at the depth limit can hold more
+            for (uint32_t first = nodeB->first; first < nodeB->first + nodeB->count; first += BVH_LEAF_SIZE)
+            {
+                uint32_t n = nodeB->first + nodeB->count - first;
+                if (n > BVH_LEAF_SIZE)
+                    n = BVH_LEAF_SIZE;
+                struct BVHTriangle trianglesB[BVH_LEAF_SIZE];
+                m3dTransformPoints3(trianglesB[0].v[0], sizeof(M3DVector3f), b->triangles[first].v[0],
+                                    sizeof(M3DVector3f), n * 3, bToA);
+                for (uint32_t j = 0; j < n; ++j)
+                {
+                    for (uint32_t i = nodeA->first; i < nodeA->first + nodeA->count; ++i)
+                    {
+                        if (trianglesIntersect(a->triangles[i].v, trianglesB[j].v))
+                            return 1;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // split the interior node with the larger box
+        float sizeA = 0.0f, sizeB = 0.0f;
+        for (int k = 0; k < 3; ++k)
+        {
+            sizeA += nodeA->boundsMax[k] - nodeA->boundsMin[k];
+            sizeB += nodeB->boundsMax[k] - nodeB->boundsMin[k];
+        }
+        bool splitA = nodeB->count > 0 || (nodeA->count == 0 && sizeA >= sizeB);
+        for (uint32_t child = 0; child < 2; ++child)
+        {
+            stack[top][0] = splitA ? nodeA->first + child : indexA;
+            stack[top][1] = splitA ? indexB : nodeB->first + child;
+            top++;
+        }
+    }
+    return 0;
+}
+
+// inverse(a) * b for rigid a
+static void getRelativeTransform(const M3DMatrix44f a, const M3DMatrix44f b, M3DMatrix44f bToA)
+{
+    M3DMatrix44f inverse;
+    m3dInvertRigidMatrix44(inverse, a);
+    m3dMatrixMultiply44(bToA, inverse, b);
+}
+
+void findSelfCollisionPairs(const struct MeshBVH linkBVHs[NUM_LINKS], const struct OrientedBox linkBoxes[NUM_LINKS],
+                            struct SelfCollisionPairs* pairs)
+{
+    float restAngles[NUM_LINKS] = { 0.0f };
+    M3DMatrix44f matrices[NUM_LINKS];
+    computeLinkMatrices(restAngles, matrices);
+
+    pairs->numPairs = 0;
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        for (int j = i + 2; j < NUM_LINKS; ++j)
+        {
+            struct OrientedBox boxA, boxB;
+            transformBox(matrices[i], &linkBoxes[i], &boxA);
+            transformBox(matrices[j], &linkBoxes[j], &boxB);
+            M3DMatrix44f bToA;
+            getRelativeTransform(matrices[i], matrices[j], bToA);
+            if (testOBBOverlap(&boxA, &boxB) && testMeshPair(&linkBVHs[i], &linkBVHs[j], bToA))
+                continue;
+            pairs->links[pairs->numPairs][0] = i;
+            pairs->links[pairs->numPairs][1] = j;
+            pairs->numPairs++;
+        }
+    }
+}
+
+int checkSelfCollision(const struct MeshBVH linkBVHs[NUM_LINKS], const struct OrientedBox linkBoxes[NUM_LINKS],
+                       const struct SelfCollisionPairs* pairs, struct KinematicChain* chain,
+                       struct SelfCollisionState* state)
+{
+    updateKinematicChain(chain);
+    if (state->valid && state->chainVersion == chain->version)
+        return state->colliding;
+    state->valid = 1;
+    state->chainVersion = chain->version;
+    state->colliding = 0;
+
+    struct OrientedBox boxes[NUM_LINKS];
+    for (int i = 0; i < NUM_LINKS; ++i)
+        transformBox(chain->linkMatrices[i], &linkBoxes[i], &boxes[i]);
+
+    for (int first = 0; first < pairs->numPairs; first += 4)
+    {
+        int count = pairs->numPairs - first < 4 ? pairs->numPairs - first : 4;
+        int overlapping = 0;
+#ifdef __SSE2__
+        // unused lanes repeat the last pair
+        const struct OrientedBox* a[4];
+        const struct OrientedBox* b[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            int pair = first + (k < count ? k : count - 1);
+            a[k] = &boxes[pairs->links[pair][0]];
+            b[k] = &boxes[pairs->links[pair][1]];
+        }
+        overlapping = testOBBOverlap4(a, b);
+#else
+        for (int k = 0; k < count; ++k)
+        {
+            const int* links = pairs->links[first + k];
+            if (testOBBOverlap(&boxes[links[0]], &boxes[links[1]]))
+                overlapping |= 1 << k;
+        }
+#endif
+        for (int k = 0; k < count; ++k)
+        {
+            if (!(overlapping & (1 << k)))
+                continue;
+            const int* links = pairs->links[first + k];
+            M3DMatrix44f bToA;
+            getRelativeTransform(chain->linkMatrices[links[0]], chain->linkMatrices[links[1]], bToA);
+            if (testMeshPair(&linkBVHs[links[0]], &linkBVHs[links[1]], bToA))
+            {
+                state->colliding = 1;
+                state->links[0] = links[0];
+                state->links[1] = links[1];
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
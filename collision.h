@@ -0,0 +1,77 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <stdint.h>
+#include "bvh.h"
+#include "kinematics.h"
+
+// Closest point of the arm surface to a sphere, in arm base coordinates
+struct ArmContact
+{
+    int link;
+    uint32_t facet;         // STL facet index within the link
+    float distance;         // from the sphere center
+    float point[3];
+};
+
+// Queries every link's BVH with the sphere moved into the link frame (the
+// link matrices are rigid, so this is a transposed rotation). Returns 1 and
+// fills contact if any link is within radius of center.
+int findArmSphereContact(const struct MeshBVH linkBVHs[NUM_LINKS], struct KinematicChain* chain,
+                         const float center[3], float radius, struct ArmContact* contact);
+
+// Continuous version of findArmSphereContact for the linear joint motion
+// from + t * (to - from), t in [0, 1], by conservative advancement: each
+// step moves t by the current clearance over a bound on how fast any point
+// of a link can move. Never steps past a contact. Returns 1 and the first t
+// where the arm comes within tolerance of the sphere (time, contact), 0 if
+// the whole motion is clear. iterations bounds the work; running out
+// reports a contact at the last safe t.
+#define CCD_MAX_ITERATIONS 1000
+int findFirstSphereImpact(const struct MeshBVH linkBVHs[NUM_LINKS], const float fromAngles[NUM_LINKS],
+                          const float toAngles[NUM_LINKS], const float center[3], float radius, float tolerance,
+                          float* time, struct ArmContact* contact);
+
+// Box with its own axes (columns of a rotation), in the frame of one link
+struct OrientedBox
+{
+    float center[3];
+    float axes[3][3];       // axes[i] is the i-th unit axis
+    float halfExtents[3];
+};
+
+// Tightest of the principal axis box and the link frame box around the
+// BVH's triangles
+void computeMeshOBB(const struct MeshBVH* bvh, struct OrientedBox* box);
+
+// Separating axis test (15 axes) for two boxes in the same frame
+int testOBBOverlap(const struct OrientedBox* a, const struct OrientedBox* b);
+
+// Link pairs that are not joined by a joint and do not already touch with
+// all joints at 0 (e.g. a base that holds the second joint's motor)
+struct SelfCollisionPairs
+{
+    int numPairs;
+    int links[NUM_LINKS * NUM_LINKS][2];
+};
+
+void findSelfCollisionPairs(const struct MeshBVH linkBVHs[NUM_LINKS], const struct OrientedBox linkBoxes[NUM_LINKS],
+                            struct SelfCollisionPairs* pairs);
+
+// Result of the last check, reused until the chain's matrices change
+struct SelfCollisionState
+{
+    uint32_t chainVersion;
+    int valid;
+    int colliding;
+    int links[2];           // first colliding pair
+};
+
+// Boxes first (four pairs at a time with SSE2), then triangles of the pairs
+// whose boxes overlap, stopping at the first intersection. Returns 1 if any
+// pair collides.
+int checkSelfCollision(const struct MeshBVH linkBVHs[NUM_LINKS], const struct OrientedBox linkBoxes[NUM_LINKS],
+                       const struct SelfCollisionPairs* pairs, struct KinematicChain* chain,
+                       struct SelfCollisionState* state);
+
+#endif
@@ -13,6 +13,8 @@
 #endif
 #include "math3d.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
 #include <iostream>
 using namespace std;
@@ -349,6 +351,151 @@ void gltDrawSphere(GLfloat fRadius, GLint iSlices, GLint iStacks)
     }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Same sphere as gltDrawSphere, but the unit sphere of each (slices, stacks)
+// is built once into a vertex and index buffer and scaled by the modelview.
+// Needs GL_NORMALIZE (or GL_RESCALE_NORMAL) for correct lighting.
+#define GLT_MAX_SPHERE_BATCHES	8
+
+struct GLTSphereVertex
+	{
+	GLfloat position[3];		// doubles as the normal
+	GLfloat texCoord[2];
+	};
+
+struct GLTSphereBatch
+	{
+	GLint iSlices;
+	GLint iStacks;
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+	GLsizei numIndices;
+	};
+
+static GLTSphereBatch sphereBatches[GLT_MAX_SPHERE_BATCHES];
+static int numSphereBatches = 0;
+
+static GLTSphereBatch *gltFindSphereBatch(GLint iSlices, GLint iStacks)
+	{
+	for(int i = 0; i < numSphereBatches; i++)
+		if(sphereBatches[i].iSlices == iSlices && sphereBatches[i].iStacks == iStacks)
+			return &sphereBatches[i];
+
+	if(numSphereBatches == GLT_MAX_SPHERE_BATCHES)
+		return NULL;
+
+	// Rows of vertices from the +z pole to the -z pole, the last column
+	// repeats the first with s = 1
+	GLint iColumns = iSlices + 1;
+	GLint nVerts = (iStacks + 1) * iColumns;
+	if(nVerts > 0x10000)
+		return NULL;
+
+	GLTSphereVertex *pVerts = (GLTSphereVertex *)malloc(nVerts * sizeof(GLTSphereVertex));
+	GLushort *pIndices = (GLushort *)malloc(iStacks * iSlices * 6 * sizeof(GLushort));
+	if(pVerts == NULL || pIndices == NULL)
+		{
+		free(pVerts);
+		free(pIndices);
+		return NULL;
+		}
+
+	GLfloat drho = (GLfloat)(3.141592653589) / (GLfloat) iStacks;
+	GLfloat dtheta = 2.0f * (GLfloat)(3.141592653589) / (GLfloat) iSlices;
+	for(GLint i = 0; i <= iStacks; i++)
+		{
+		GLfloat rho = (GLfloat)i * drho;
+		GLfloat srho = (GLfloat)(sin(rho));
+		GLfloat crho = (GLfloat)(cos(rho));
+		for(GLint j = 0; j <= iSlices; j++)
+			{
+			GLfloat theta = (j == iSlices) ? 0.0f : j * dtheta;
+			GLTSphereVertex *pVert = &pVerts[i * iColumns + j];
+			pVert->position[0] = (GLfloat)(-sin(theta)) * srho;
+			pVert->position[1] = (GLfloat)(cos(theta)) * srho;
+			pVert->position[2] = crho;
+			pVert->texCoord[0] = (GLfloat)j / (GLfloat)iSlices;
+			pVert->texCoord[1] = 1.0f - (GLfloat)i / (GLfloat)iStacks;
+			}
+		}
+
+	// The triangles of gltDrawSphere's strips, same winding
+	GLsizei nIndices = 0;
+	for(GLint i = 0; i < iStacks; i++)
+		for(GLint j = 0; j < iSlices; j++)
+			{
+			GLushort a = (GLushort)(i * iColumns + j);
+			GLushort b = (GLushort)(a + iColumns);
+			pIndices[nIndices++] = a;
+			pIndices[nIndices++] = b;
+			pIndices[nIndices++] = (GLushort)(a + 1);
+			pIndices[nIndices++] = b;
+			pIndices[nIndices++] = (GLushort)(b + 1);
+			pIndices[nIndices++] = (GLushort)(a + 1);
+			}
+
+	GLTSphereBatch *pBatch = &sphereBatches[numSphereBatches++];
+	pBatch->iSlices = iSlices;
+	pBatch->iStacks = iStacks;
+	pBatch->numIndices = nIndices;
+	glGenBuffers(1, &pBatch->vertexBuffer);
+	glGenBuffers(1, &pBatch->indexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, pBatch->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, nVerts * sizeof(GLTSphereVertex), pVerts, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pBatch->indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, nIndices * sizeof(GLushort), pIndices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	free(pVerts);
+	free(pIndices);
+	return pBatch;
+	}
+
+void gltDrawSphereBatch(GLfloat fRadius, GLint iSlices, GLint iStacks)
+	{
+	GLTSphereBatch *pBatch = gltFindSphereBatch(iSlices, iStacks);
+	if(pBatch == NULL)
+		{
+		// Cache full or too many vertices for 16-bit indices
+		gltDrawSphere(fRadius, iSlices, iStacks);
+		return;
+		}
+
+	glPushMatrix();
+	glScalef(fRadius, fRadius, fRadius);
+
+	glBindBuffer(GL_ARRAY_BUFFER, pBatch->vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pBatch->indexBuffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(GLTSphereVertex), (const GLvoid *)offsetof(GLTSphereVertex, position));
+	glNormalPointer(GL_FLOAT, sizeof(GLTSphereVertex), (const GLvoid *)offsetof(GLTSphereVertex, position));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(GLTSphereVertex), (const GLvoid *)offsetof(GLTSphereVertex, texCoord));
+
+	glDrawElements(GL_TRIANGLES, pBatch->numIndices, GL_UNSIGNED_SHORT, 0);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glPopMatrix();
+	}
+
+void gltDeleteSphereBatches(void)
+	{
+	for(int i = 0; i < numSphereBatches; i++)
+		{
+		glDeleteBuffers(1, &sphereBatches[i].vertexBuffer);
+		glDeleteBuffers(1, &sphereBatches[i].indexBuffer);
+		}
+	numSphereBatches = 0;
+	}
+
+
 // Define targa header. This is only used locally.
 #pragma pack(1)
 typedef struct
@@ -131,6 +131,10 @@ void gltDrawTorus(GLfloat majorRadius, GLfloat minorRadius, GLint numMajor, GLin
 // Just draw a simple sphere with normals and texture coordinates
 void gltDrawSphere(GLfloat fRadius, GLint iSlices, GLint iStacks);
 
+// Same sphere from a vertex buffer, built on first use for each (slices, stacks)
+void gltDrawSphereBatch(GLfloat fRadius, GLint iSlices, GLint iStacks);
+void gltDeleteSphereBatches(void);
+
 // Draw a 3D unit Axis set
 void gltDrawUnitAxes(void);
 
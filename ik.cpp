@@ -0,0 +1,136 @@
+#include "ik.h"
+
+#include <math.h>
+#include <omp.h>
+
+static void getClawTip(const M3DMatrix44f clawMatrix, float clawLength, float tip[3])
+{
+    for (int k = 0; k < 3; ++k)
+        tip[k] = clawMatrix[12 + k] + clawMatrix[4 + k] * clawLength;
+}
+
+// Solves (J J^T + damping^2 I) y = e with Cramer's rule, the matrix is 3x3
+// symmetric positive definite
+static void solveDamped3(const float jacobian[NUM_LINKS][3], const float e[3], float y[3])
+{
+    float a[3][3];
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            float sum = (r == c) ? IK_DAMPING * IK_DAMPING : 0.0f;
+            for (int j = 1; j < NUM_LINKS; ++j)
+                sum += jacobian[j][r] * jacobian[j][c];
+            a[r][c] = sum;
+        }
+    }
+    float c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    float c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+    float c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+    float inverseDet = 1.0f / (a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02);
+    float inverse[3][3] = {
+        { c00, a[0][2] * a[2][1] - a[0][1] * a[2][2], a[0][1] * a[1][2] - a[0][2] * a[1][1] },
+        { c01, a[0][0] * a[2][2] - a[0][2] * a[2][0], a[0][2] * a[1][0] - a[0][0] * a[1][2] },
+        { c02, a[0][1] * a[2][0] - a[0][0] * a[2][1], a[0][0] * a[1][1] - a[0][1] * a[1][0] }
+    };
+    for (int r = 0; r < 3; ++r)
+        y[r] = (inverse[r][0] * e[0] + inverse[r][1] * e[1] + inverse[r][2] * e[2]) * inverseDet;
+}
+
+IKStatus solveClawIK(float jointAngles[NUM_LINKS], const float target[3], float clawLength, float tolerance,
+                     int maxIterations, double budgetMicroseconds, struct IKResult* result)
+{
+    double deadline = budgetMicroseconds > 0.0 ? omp_get_wtime() + budgetMicroseconds * 1e-6 : 0.0;
+    M3DMatrix44f matrices[NUM_LINKS];
+    float bestError = INFINITY;
+    int sinceBest = 0;
+    int iterations = 0;
+    IKStatus status;
+    float error;
+
+    for (;;)
+    {
+        computeLinkMatrices(jointAngles, matrices);
+        float tip[3], e[3];
+        getClawTip(matrices[NUM_LINKS - 1], clawLength, tip);
+        m3dSubtractVectors3(e, target, tip);
+        error = m3dGetVectorLength(e);
+
+        if (error <= tolerance)
+        {
+            status = IKConverged;
+            break;
+        }
+        if (error < bestError - 0.001f * tolerance)
+        {
+            bestError = error;
+            sinceBest = 0;
+        }
+        else if (++sinceBest >= IK_STALL_ITERATIONS)
+        {
+            status = IKStalled;
+            break;
+        }
+        if (iterations >= maxIterations || (deadline > 0.0 && omp_get_wtime() >= deadline))
+        {
+            status = IKUnfinished;
+            break;
+        }
+
+        // the linearization only holds for small moves
+        if (error > IK_MAX_STEP)
+            m3dScaleVector3(e, IK_MAX_STEP / error);
+
+        // column j: tip velocity per radian of joint j, axis x (tip - joint)
+        float jacobian[NUM_LINKS][3];
+        for (int j = 1; j < NUM_LINKS; ++j)
+        {
+            const float* a = linkRotateAxis[j];
+            const float* m = matrices[j];
+            M3DVector3f axis, arm;
+            for (int k = 0; k < 3; ++k)
+            {
+                axis[k] = m[k] * a[0] + m[4 + k] * a[1] + m[8 + k] * a[2];
+                arm[k] = tip[k] - m[12 + k];
+            }
+            m3dCrossProduct(jacobian[j], axis, arm);
+        }
+
+        float y[3];
+        solveDamped3(jacobian, e, y);
+        for (int j = 1; j < NUM_LINKS; ++j)
+            jointAngles[j] += m3dRadToDeg(m3dDotProduct(jacobian[j], y));
+        iterations++;
+    }
+
+    for (int j = 1; j < NUM_LINKS; ++j)
+    {
+        jointAngles[j] = fmodf(jointAngles[j], 360.0f);
+        if (jointAngles[j] < 0.0f)
+            jointAngles[j] += 360.0f;
+    }
+    if (result)
+    {
+        result->status = status;
+        result->iterations = iterations;
+        result->error = error;
+    }
+    return status;
+}
+
+void solveClawIKBatch(float* const jointAngles[NUM_LINKS - 1], const float* const targets[3], size_t count,
+                      float clawLength, float tolerance, int maxIterations, struct IKResult* results)
+{
+    // iteration counts vary a lot between targets
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int64_t k = 0; k < (int64_t)count; ++k)
+    {
+        float angles[NUM_LINKS] = { 0.0f };
+        for (int j = 1; j < NUM_LINKS; ++j)
+            angles[j] = jointAngles[j - 1][k];
+        float target[3] = { targets[0][k], targets[1][k], targets[2][k] };
+        solveClawIK(angles, target, clawLength, tolerance, maxIterations, 0.0, results ? &results[k] : NULL);
+        for (int j = 1; j < NUM_LINKS; ++j)
+            jointAngles[j - 1][k] = angles[j];
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef IK_H
+#define IK_H
+
+#include <stddef.h>
+#include "kinematics.h"
+
+// Damped least-squares inverse kinematics for the claw tip (clawLength
+// along the last link's y axis). Only the tip position is constrained, so
+// joints that cannot move it (the claw spin) are left alone.
+#define IK_DAMPING 10.0f            // model units, keeps steps sane near singular poses
+#define IK_MAX_STEP 50.0f           // longest tip move requested per iteration
+#define IK_STALL_ITERATIONS 8       // without improvement before giving up
+
+enum IKStatus
+{
+    IKConverged,        // tip within tolerance of the target
+    IKStalled,          // no progress, target out of reach or at a singularity
+    IKUnfinished        // ran out of iterations or time, call again to continue
+};
+
+struct IKResult
+{
+    IKStatus status;
+    int iterations;
+    float error;        // distance from tip to target
+};
+
+// Warm-starts from jointAngles (degrees, joint 0 is ignored) and writes the
+// solution back, wrapped into [0, 360). Stops after maxIterations or once
+// budgetMicroseconds have passed, 0 for no time limit.
+IKStatus solveClawIK(float jointAngles[NUM_LINKS], const float target[3], float clawLength, float tolerance,
+                     int maxIterations, double budgetMicroseconds, struct IKResult* result);
+
+// count independent problems solved in parallel (OpenMP), without a time
+// budget. Angles and targets are structure of arrays as in
+// computeClawPositionsBatch: jointAngles[j][k] is joint j + 1 of problem k,
+// updated in place. results may be NULL.
+void solveClawIKBatch(float* const jointAngles[NUM_LINKS - 1], const float* const targets[3], size_t count,
+                      float clawLength, float tolerance, int maxIterations, struct IKResult* results);
+
+#endif
@@ -0,0 +1,309 @@
+#include "kinematics.h"
+
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const float linkOrigins[NUM_LINKS][3] = {
+    {0, -180, 0},
+    {0, 20, 0},
+    {0, 40, 0},
+    {32.5, 120, 0},
+    {0, 115, 0}
+};
+
+const float linkRotateAxis[NUM_LINKS][3] = {
+    {0.0f, 0.0f, 0.0f},     // place holder
+    {0.0f, 1.0f, 0.0f},     // link 0-1 y axis
+    {1.0f, 0.0f, 0.0f},     // link 1-2 x axis
+    {1.0f, 0.0f, 0.0f},     // link 2-3 x axis
+    {0.0f, 1.0f, 0.0f}      // link 3-4 y axis
+};
+
+// Translation to the link origin followed by the joint rotation, same as
+// glTranslatef then glRotatef
+static void computeLocalMatrix(M3DMatrix44f m, int link, float degrees)
+{
+    m3dRotationMatrix44(m, m3dDegToRad(degrees), linkRotateAxis[link][0], linkRotateAxis[link][1],
+                        linkRotateAxis[link][2]);
+    m[12] = linkOrigins[link][0];
+    m[13] = linkOrigins[link][1];
+    m[14] = linkOrigins[link][2];
+}
+
+void initKinematicChain(struct KinematicChain* chain)
+{
+    memset(chain, 0, sizeof(*chain));
+    updateKinematicChain(chain);
+}
+
+void setJointAngle(struct KinematicChain* chain, int joint, float degrees)
+{
+    if (chain->jointAngles[joint] == degrees)
+        return;
+    chain->jointAngles[joint] = degrees;
+    if (joint < chain->dirtyFrom)
+        chain->dirtyFrom = joint;
+}
+
+int updateKinematicChain(struct KinematicChain* chain)
+{
+    if (chain->dirtyFrom >= NUM_LINKS)
+        return 0;
+
+    M3DMatrix44f localMatrix;
+    for (int i = chain->dirtyFrom; i < NUM_LINKS; ++i)
+    {
+        computeLocalMatrix(localMatrix, i, chain->jointAngles[i]);
+        if (i == 0)
+            m3dCopyMatrix44(chain->linkMatrices[0], localMatrix);
+        else
+            m3dMatrixMultiply44(chain->linkMatrices[i], chain->linkMatrices[i - 1], localMatrix);
+    }
+    chain->dirtyFrom = NUM_LINKS;
+    chain->version++;
+    return 1;
+}
+
+void computeLinkMatrices(const float jointAngles[NUM_LINKS], M3DMatrix44f matrices[NUM_LINKS])
+{
+    M3DMatrix44f localMatrix;
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        computeLocalMatrix(localMatrix, i, jointAngles[i]);
+        if (i == 0)
+            m3dCopyMatrix44(matrices[0], localMatrix);
+        else
+            m3dMatrixMultiply44(matrices[i], matrices[i - 1], localMatrix);
+    }
+}
+
+void computeLinkDualQuaternions(const float jointAngles[NUM_LINKS], struct M3DDualQuaternionf poses[NUM_LINKS])
+{
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        // translation to the link origin after the joint rotation, as in
+        // computeLocalMatrix. The joint axes are unit length or zero for the
+        // fixed base, which m3dRotationMatrix44 treats as no rotation.
+        struct M3DDualQuaternionf local;
+        M3DQuaternionf rotation;
+        const float* axis = linkRotateAxis[i];
+        if (axis[0] == 0.0f && axis[1] == 0.0f && axis[2] == 0.0f)
+        {
+            m3dLoadIdentityQuaternion(rotation);
+        }
+        else
+        {
+            float halfAngle = 0.5f * m3dDegToRad(jointAngles[i]);
+            float s = sinf(halfAngle);
+            rotation[0] = axis[0] * s;
+            rotation[1] = axis[1] * s;
+            rotation[2] = axis[2] * s;
+            rotation[3] = cosf(halfAngle);
+        }
+        m3dDualQuaternionFromRotationTranslation(&local, rotation, linkOrigins[i]);
+        if (i == 0)
+            poses[0] = local;
+        else
+            m3dDualQuaternionMultiply(&poses[i], &poses[i - 1], &local);
+    }
+}
+
+// Unit joint axes, looked up once per batch. Joints about a coordinate axis
+// only mix two columns of the accumulated rotation.
+#define JOINT_FIXED -1
+#define JOINT_GENERAL 3
+struct JointAxes
+{
+    float axis[NUM_LINKS][3];
+    int kind[NUM_LINKS];        // JOINT_FIXED, 0-2 for x, y, z, or JOINT_GENERAL
+};
+
+static void getJointAxes(struct JointAxes* axes)
+{
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        const float* a = linkRotateAxis[i];
+        float length = m3dGetVectorLength(a);
+        axes->kind[i] = JOINT_GENERAL;
+        if (length == 0.0f)
+            axes->kind[i] = JOINT_FIXED;
+        else if (a[1] == 0.0f && a[2] == 0.0f && a[0] > 0.0f)
+            axes->kind[i] = 0;
+        else if (a[0] == 0.0f && a[2] == 0.0f && a[1] > 0.0f)
+            axes->kind[i] = 1;
+        else if (a[0] == 0.0f && a[1] == 0.0f && a[2] > 0.0f)
+            axes->kind[i] = 2;
+        for (int k = 0; k < 3; ++k)
+            axes->axis[i][k] = length == 0.0f ? 0.0f : a[k] / length;
+    }
+}
+
+// One configuration. Same chain as computeLinkMatrices, kept as a 3x3
+// rotation plus translation.
+static void computeClawPosition(const struct JointAxes* axes, const float* const jointAngles[NUM_LINKS - 1],
+                                size_t k, float clawLength, float base[3], float tip[3])
+{
+    float r[3][3] = { {1, 0, 0}, {0, 1, 0}, {0, 0, 1} };   // r[row][col]
+    float t[3] = { 0, 0, 0 };
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        // t += r * origin
+        const float* o = linkOrigins[i];
+        for (int row = 0; row < 3; ++row)
+            t[row] += r[row][0] * o[0] + r[row][1] * o[1] + r[row][2] * o[2];
+
+        if (axes->kind[i] == JOINT_FIXED)
+            continue;
+        const float* a = axes->axis[i];
+        float angle = m3dDegToRad(jointAngles[i - 1][k]);
+        float s = sinf(angle), c = cosf(angle), oneC = 1.0f - c;
+        float rot[3][3] = {
+            { oneC * a[0] * a[0] + c,        oneC * a[0] * a[1] - a[2] * s, oneC * a[2] * a[0] + a[1] * s },
+            { oneC * a[0] * a[1] + a[2] * s, oneC * a[1] * a[1] + c,        oneC * a[1] * a[2] - a[0] * s },
+            { oneC * a[2] * a[0] - a[1] * s, oneC * a[1] * a[2] + a[0] * s, oneC * a[2] * a[2] + c }
+        };
+        float product[3][3];
+        for (int row = 0; row < 3; ++row)
+            for (int col = 0; col < 3; ++col)
+                product[row][col] = r[row][0] * rot[0][col] + r[row][1] * rot[1][col] + r[row][2] * rot[2][col];
+        memcpy(r, product, sizeof(r));
+    }
+    for (int row = 0; row < 3; ++row)
+    {
+        base[row] = t[row];
+        tip[row] = t[row] + r[row][1] * clawLength;
+    }
+}
+
+#ifdef __SSE2__
+// sin and cos of four angles in degrees. Reduced by quarter turns in
+// degrees, which is exact, then Cephes minimax polynomials on [-45, 45].
+static inline void sinCosDegrees4(__m128 degrees, __m128* sine, __m128* cosine)
+{
+    __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(degrees, _mm_set1_ps(1.0f / 90.0f)));
+    __m128 x = _mm_sub_ps(degrees, _mm_mul_ps(_mm_cvtepi32_ps(quadrant), _mm_set1_ps(90.0f)));
+    x = _mm_mul_ps(x, _mm_set1_ps((float)(M3D_PI / 180.0)));
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), z), _mm_set1_ps(8.3321608736e-3f));
+    s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(-1.6666654611e-1f));
+    s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, z), x), x);
+
+    __m128 c = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), z), _mm_set1_ps(-1.388731625493765e-3f));
+    c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(4.166664568298827e-2f));
+    c = _mm_mul_ps(_mm_mul_ps(c, z), z);
+    c = _mm_add_ps(_mm_sub_ps(c, _mm_mul_ps(z, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+    // odd quadrants swap sin and cos; quadrants 2, 3 negate sin, 1, 2 negate cos
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)),
+                                                                   _mm_set1_epi32(2)), 30));
+    __m128 sinResult = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+    __m128 cosResult = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+    *sine = _mm_xor_ps(sinResult, sinSign);
+    *cosine = _mm_xor_ps(cosResult, cosSign);
+}
+
+// Four configurations per iteration, one per lane
+static void computeClawPositions4(const struct JointAxes* axes, const float* const jointAngles[NUM_LINKS - 1],
+                                  size_t k, float clawLength, float* const basePositions[3],
+                                  float* const tipPositions[3])
+{
+    __m128 r[3][3];
+    __m128 t[3];
+    for (int row = 0; row < 3; ++row)
+    {
+        for (int col = 0; col < 3; ++col)
+            r[row][col] = _mm_set1_ps(row == col ? 1.0f : 0.0f);
+        t[row] = _mm_setzero_ps();
+    }
+
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        const float* o = linkOrigins[i];
+        __m128 ox = _mm_set1_ps(o[0]), oy = _mm_set1_ps(o[1]), oz = _mm_set1_ps(o[2]);
+        for (int row = 0; row < 3; ++row)
+            t[row] = _mm_add_ps(t[row], _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[row][0], ox), _mm_mul_ps(r[row][1], oy)),
+                                                   _mm_mul_ps(r[row][2], oz)));
+
+        int kind = axes->kind[i];
+        if (kind == JOINT_FIXED)
+            continue;
+        __m128 s, c;
+        sinCosDegrees4(_mm_loadu_ps(&jointAngles[i - 1][k]), &s, &c);
+
+        if (kind != JOINT_GENERAL)
+        {
+            // rotation about coordinate axis kind: columns u and v turn into
+            // c * u + s * v and c * v - s * u
+            int u = (kind + 1) % 3, v = (kind + 2) % 3;
+            for (int row = 0; row < 3; ++row)
+            {
+                __m128 ru = r[row][u], rv = r[row][v];
+                r[row][u] = _mm_add_ps(_mm_mul_ps(c, ru), _mm_mul_ps(s, rv));
+                r[row][v] = _mm_sub_ps(_mm_mul_ps(c, rv), _mm_mul_ps(s, ru));
+            }
+            continue;
+        }
+
+        const float* a = axes->axis[i];
+        __m128 oneC = _mm_sub_ps(_mm_set1_ps(1.0f), c);
+        __m128 xs = _mm_mul_ps(_mm_set1_ps(a[0]), s);
+        __m128 ys = _mm_mul_ps(_mm_set1_ps(a[1]), s);
+        __m128 zs = _mm_mul_ps(_mm_set1_ps(a[2]), s);
+        __m128 rot[3][3] = {
+            { _mm_add_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[0] * a[0])), c),
+              _mm_sub_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[0] * a[1])), zs),
+              _mm_add_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[2] * a[0])), ys) },
+            { _mm_add_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[0] * a[1])), zs),
+              _mm_add_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[1] * a[1])), c),
+              _mm_sub_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[1] * a[2])), xs) },
+            { _mm_sub_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[2] * a[0])), ys),
+              _mm_add_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[1] * a[2])), xs),
+              _mm_add_ps(_mm_mul_ps(oneC, _mm_set1_ps(a[2] * a[2])), c) }
+        };
+        __m128 product[3][3];
+        for (int row = 0; row < 3; ++row)
+            for (int col = 0; col < 3; ++col)
+                product[row][col] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[row][0], rot[0][col]),
+                                                          _mm_mul_ps(r[row][1], rot[1][col])),
+                                               _mm_mul_ps(r[row][2], rot[2][col]));
+        memcpy(r, product, sizeof(r));
+    }
+
+    __m128 length = _mm_set1_ps(clawLength);
+    for (int row = 0; row < 3; ++row)
+    {
+        _mm_storeu_ps(&basePositions[row][k], t[row]);
+        _mm_storeu_ps(&tipPositions[row][k], _mm_add_ps(t[row], _mm_mul_ps(r[row][1], length)));
+    }
+}
+#endif
+
+void computeClawPositionsBatch(const float* const jointAngles[NUM_LINKS - 1], size_t count, float clawLength,
+                               float* const basePositions[3], float* const tipPositions[3])
+{
+    struct JointAxes axes;
+    getJointAxes(&axes);
+
+    size_t k = 0;
+#ifdef __SSE2__
+    for (; k + 4 <= count; k += 4)
+        computeClawPositions4(&axes, jointAngles, k, clawLength, basePositions, tipPositions);
+#endif
+    for (; k < count; ++k)
+    {
+        float base[3], tip[3];
+        computeClawPosition(&axes, jointAngles, k, clawLength, base, tip);
+        for (int row = 0; row < 3; ++row)
+        {
+            basePositions[row][k] = base[row];
+            tipPositions[row][k] = tip[row];
+        }
+    }
+}
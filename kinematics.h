@@ -0,0 +1,56 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "math3d.h"
+
+#define NUM_LINKS 5
+
+// Link i is placed at linkOrigins[i] in the frame of link i - 1 and turns
+// about linkRotateAxis[i]. Link 0 is the fixed base.
+extern const float linkOrigins[NUM_LINKS][3];
+extern const float linkRotateAxis[NUM_LINKS][3];
+
+// Joint angles of one arm and the cached link to arm base matrices. Setting
+// a joint only invalidates that link and the links after it; the matrices
+// are brought up to date by updateKinematicChain.
+struct KinematicChain
+{
+    float jointAngles[NUM_LINKS];           // degrees
+    M3DMatrix44f linkMatrices[NUM_LINKS];
+    int dirtyFrom;                          // first stale link, NUM_LINKS when up to date
+    uint32_t version;                       // bumped every time a matrix changes
+};
+
+// All joints at 0 degrees, matrices up to date
+void initKinematicChain(struct KinematicChain* chain);
+// Marks the chain dirty only if the angle actually changes
+void setJointAngle(struct KinematicChain* chain, int joint, float degrees);
+// Recomputes the stale links. Returns 1 if anything changed.
+int updateKinematicChain(struct KinematicChain* chain);
+
+// Up to date matrix of one link
+inline const float* getLinkMatrix(struct KinematicChain* chain, int link)
+{
+    updateKinematicChain(chain);
+    return chain->linkMatrices[link];
+}
+
+// Uncached forward kinematics of a whole chain
+void computeLinkMatrices(const float jointAngles[NUM_LINKS], M3DMatrix44f matrices[NUM_LINKS]);
+// Same on dual quaternions: one half angle sin/cos per joint and a 48
+// multiply product per link instead of a rotation matrix and a 4x4 product.
+// m3dDualQuaternionToMatrix44 gives back the matrix of a link.
+void computeLinkDualQuaternions(const float jointAngles[NUM_LINKS], struct M3DDualQuaternionf poses[NUM_LINKS]);
+
+// Claw base (origin of the last link) and tip (clawLength along the last
+// link's y axis) in arm base coordinates for count joint configurations.
+// Angles are structure of arrays: jointAngles[j][k] is joint j + 1 of
+// configuration k, in degrees. Outputs are structure of arrays as well.
+// Four configurations are done at once with SSE2, the remainder (and
+// non-SSE builds) falls back to scalar code.
+void computeClawPositionsBatch(const float* const jointAngles[NUM_LINKS - 1], size_t count, float clawLength,
+                               float* const basePositions[3], float* const tipPositions[3]);
+
+#endif
@@ -0,0 +1,85 @@
+#include "mapfile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+int mapFile(const char* filename, struct MappedFile* file)
+{
+    memset(file, 0, sizeof(*file));
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Failed to open file %s\n", filename);
+        return 0;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0) {
+        fprintf(stderr, "Failed to get size of %s\n", filename);
+        CloseHandle(hFile);
+        return 0;
+    }
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMapping) {
+        fprintf(stderr, "Failed to map file %s\n", filename);
+        CloseHandle(hFile);
+        return 0;
+    }
+    const void* view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        fprintf(stderr, "Failed to map view of %s\n", filename);
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return 0;
+    }
+    file->fileHandle = hFile;
+    file->mappingHandle = hMapping;
+    file->data = (const unsigned char*)view;
+    file->size = (size_t)fileSize.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Failed to get size of %s\n", filename);
+        close(fd);
+        return 0;
+    }
+    void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (view == MAP_FAILED) {
+        perror("Failed to map file");
+        return 0;
+    }
+    file->data = (const unsigned char*)view;
+    file->size = (size_t)st.st_size;
+#endif
+    return 1;
+}
+
+void unmapFile(struct MappedFile* file)
+{
+    if (!file->data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+    CloseHandle((HANDLE)file->mappingHandle);
+    CloseHandle((HANDLE)file->fileHandle);
+#else
+    munmap((void*)file->data, file->size);
+#endif
+    memset(file, 0, sizeof(*file));
+}
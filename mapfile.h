@@ -0,0 +1,23 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stddef.h>
+
+// A whole file mapped read-only into the address space. Pages are faulted in
+// on first access and are backed by the file itself, so they can be dropped
+// by the OS under memory pressure instead of being written to swap.
+struct MappedFile
+{
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+};
+
+// Returns 1 on success, 0 on failure (and reports the error on stderr).
+int mapFile(const char* filename, struct MappedFile* file);
+void unmapFile(struct MappedFile* file);
+
+#endif
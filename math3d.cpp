@@ -5,152 +5,57 @@
 // These are pretty portable
 #include <math.h>
 #include "math3d.h"
+#include "math3d.hpp"
 
 
 ////////////////////////////////////////////////////////////
 // LoadIdentity
 // For 3x3 and 4x4 float and double matricies.
-// 3x3 float
+// Don't be fooled, this is still column major
 void m3dLoadIdentity33(M3DMatrix33f m)
-	{
-	// Don't be fooled, this is still column major
-	static M3DMatrix33f	identity = { 1.0f, 0.0f, 0.0f ,
-									 0.0f, 1.0f, 0.0f,
-									 0.0f, 0.0f, 1.0f };
-
-	memcpy(m, identity, sizeof(M3DMatrix33f));
-	}
+	{ M3DMat33f::identity().store(m); }
 
-// 3x3 double
 void m3dLoadIdentity33(M3DMatrix33d m)
-	{
-	// Don't be fooled, this is still column major
-	static M3DMatrix33d	identity = { 1.0, 0.0, 0.0 ,
-									 0.0, 1.0, 0.0,
-									 0.0, 0.0, 1.0 };
+	{ M3DMat33d::identity().store(m); }
 
-	memcpy(m, identity, sizeof(M3DMatrix33d));
-	}
-
-// 4x4 float
 void m3dLoadIdentity44(M3DMatrix44f m)
-	{
-	// Don't be fooled, this is still column major
-	static M3DMatrix44f	identity = { 1.0f, 0.0f, 0.0f, 0.0f,
-									 0.0f, 1.0f, 0.0f, 0.0f,
-									 0.0f, 0.0f, 1.0f, 0.0f,
-									 0.0f, 0.0f, 0.0f, 1.0f };
-
-	memcpy(m, identity, sizeof(M3DMatrix44f));
-	}
+	{ M3DMat44f::identity().store(m); }
 
-// 4x4 double
 void m3dLoadIdentity44(M3DMatrix44d m)
-	{
-	static M3DMatrix44d	identity = { 1.0, 0.0, 0.0, 0.0,
-									 0.0, 1.0, 0.0, 0.0,
-									 0.0, 0.0, 1.0, 0.0,
-									 0.0, 0.0, 0.0, 1.0 };
-
-	memcpy(m, identity, sizeof(M3DMatrix44d));
-	}
+	{ M3DMat44d::identity().store(m); }
 
 
 ////////////////////////////////////////////////////////////////////////
 // Return the square of the distance between two points
 // Should these be inlined...?
 float m3dGetDistanceSquared(const M3DVector3f u, const M3DVector3f v)
-	{
-	float x = u[0] - v[0];
-	x = x*x;
-	
-	float y = u[1] - v[1];
-	y = y*y;
-
-	float z = u[2] - v[2];
-	z = z*z;
-
-	return (x + y + z);
-    }
+	{ return m3dDistanceSquared(M3DVec3f::load(u), M3DVec3f::load(v)); }
 
 // Ditto above, but for doubles
 double m3dGetDistanceSquared(const M3DVector3d u, const M3DVector3d v)
-	{
-	double x = u[0] - v[0];
-	x = x*x;
-	
-	double y = u[1] - v[1];
-	y = y*y;
-
-	double z = u[2] - v[2];
-	z = z*z;
-
-	return (x + y + z);
-	}
+	{ return m3dDistanceSquared(M3DVec3d::load(u), M3DVec3d::load(v)); }
 
-#define A(row,col)  a[(col<<2)+row]
-#define B(row,col)  b[(col<<2)+row]
-#define P(row,col)  product[(col<<2)+row]
 
 ///////////////////////////////////////////////////////////////////////////////
-// Multiply two 4x4 matricies
-void m3dMatrixMultiply44(M3DMatrix44f product, const M3DMatrix44f a, const M3DMatrix44f b )
-{
-	for (int i = 0; i < 4; i++) {
-		float ai0=A(i,0),  ai1=A(i,1),  ai2=A(i,2),  ai3=A(i,3);
-		P(i,0) = ai0 * B(0,0) + ai1 * B(1,0) + ai2 * B(2,0) + ai3 * B(3,0);
-		P(i,1) = ai0 * B(0,1) + ai1 * B(1,1) + ai2 * B(2,1) + ai3 * B(3,1);
-		P(i,2) = ai0 * B(0,2) + ai1 * B(1,2) + ai2 * B(2,2) + ai3 * B(3,2);
-		P(i,3) = ai0 * B(0,3) + ai1 * B(1,3) + ai2 * B(2,3) + ai3 * B(3,3);
-	}
-}
+// Multiply two 4x4 matricies. Reference for the SIMD kernels in
+// math3d_simd.cpp, which provides m3dMatrixMultiply44 itself. The operands
+// are copied in first, so product may be a or b.
+void m3dMatrixMultiply44Scalar(M3DMatrix44f product, const M3DMatrix44f a, const M3DMatrix44f b )
+	{ (M3DMat44f::load(a) * M3DMat44f::load(b)).store(product); }
 
 // Ditto above, but for doubles
-void m3dMatrixMultiply(M3DMatrix44d product, const M3DMatrix44d a, const M3DMatrix44d b )
-{
-	for (int i = 0; i < 4; i++) {
-		double ai0=A(i,0),  ai1=A(i,1),  ai2=A(i,2),  ai3=A(i,3);
-		P(i,0) = ai0 * B(0,0) + ai1 * B(1,0) + ai2 * B(2,0) + ai3 * B(3,0);
-		P(i,1) = ai0 * B(0,1) + ai1 * B(1,1) + ai2 * B(2,1) + ai3 * B(3,1);
-		P(i,2) = ai0 * B(0,2) + ai1 * B(1,2) + ai2 * B(2,2) + ai3 * B(3,2);
-		P(i,3) = ai0 * B(0,3) + ai1 * B(1,3) + ai2 * B(2,3) + ai3 * B(3,3);
-	}
-}
-#undef A
-#undef B
-#undef P
+void m3dMatrixMultiply44(M3DMatrix44d product, const M3DMatrix44d a, const M3DMatrix44d b )
+	{ (M3DMat44d::load(a) * M3DMat44d::load(b)).store(product); }
 
 
-#define A33(row,col)  a[(col*3)+row]
-#define B33(row,col)  b[(col*3)+row]
-#define P33(row,col)  product[(col*3)+row]
-
 ///////////////////////////////////////////////////////////////////////////////
 // Multiply two 3x3 matricies
 void m3dMatrixMultiply33(M3DMatrix33f product, const M3DMatrix33f a, const M3DMatrix33f b )
-{
-	for (int i = 0; i < 3; i++) {
-		float ai0=A33(i,0), ai1=A33(i,1),  ai2=A33(i,2);
-		P33(i,0) = ai0 * B33(0,0) + ai1 * B33(1,0) + ai2 * B33(2,0);
-		P33(i,1) = ai0 * B33(0,1) + ai1 * B33(1,1) + ai2 * B33(2,1);
-		P33(i,2) = ai0 * B33(0,2) + ai1 * B33(1,2) + ai2 * B33(2,2);
-	}
-}
+	{ (M3DMat33f::load(a) * M3DMat33f::load(b)).store(product); }
 
 // Ditto above, but for doubles
-void m3dMatrixMultiply44(M3DMatrix33d product, const M3DMatrix33d a, const M3DMatrix33d b )
-{
-	for (int i = 0; i < 3; i++) {
-		double ai0=A33(i,0),  ai1=A33(i,1),  ai2=A33(i,2);
-		P33(i,0) = ai0 * B33(0,0) + ai1 * B33(1,0) + ai2 * B33(2,0);
-		P33(i,1) = ai0 * B33(0,1) + ai1 * B33(1,1) + ai2 * B33(2,1);
-		P33(i,2) = ai0 * B33(0,2) + ai1 * B33(1,2) + ai2 * B33(2,2);
-	}
-}
-
-#undef A33
-#undef B33
-#undef P33
+void m3dMatrixMultiply33(M3DMatrix33d product, const M3DMatrix33d a, const M3DMatrix33d b )
+	{ (M3DMat33d::load(a) * M3DMat33d::load(b)).store(product); }
 
 #define M33(row,col)  m[col*3+row]
 
@@ -383,8 +288,9 @@ void m3dRotationMatrix44(M3DMatrix44d m, double angle, double x, double y, doubl
  * Compute inverse of 4x4 transformation matrix.
  * Code contributed by Jacques Leroy jle@star.be
  * Return GL_TRUE for success, GL_FALSE for failure (singular matrix)
+ * Reference for the SIMD kernels in math3d_simd.cpp.
  */
-bool m3dInvertMatrix44(M3DMatrix44f dst, const M3DMatrix44f src )
+bool m3dInvertMatrix44Scalar(M3DMatrix44f dst, const M3DMatrix44f src )
     {
     #define SWAP_ROWS(a, b) { float *_tmp = a; (a)=(b); (b)=_tmp; }
     #define MAT(m,r,c) (m)[(c)*4+(r)]
@@ -620,6 +526,220 @@ bool m3dInvertMatrix44(M3DMatrix44d dst, const M3DMatrix44d src)
 	return true;
 	}
 
+// Affine only inverse, inv([A t; 0 1]) = [A^-1  -A^-1 t; 0 1]
+bool m3dInvertAffineMatrix44(M3DMatrix44f dst, const M3DMatrix44f src)
+	{
+	#define MAT(m,r,c) (m)[(c)*4+(r)]
+
+	// cofactors of the upper 3x3, transposed: the adjugate
+	float a00 = MAT(src,1,1) * MAT(src,2,2) - MAT(src,1,2) * MAT(src,2,1);
+	float a01 = MAT(src,0,2) * MAT(src,2,1) - MAT(src,0,1) * MAT(src,2,2);
+	float a02 = MAT(src,0,1) * MAT(src,1,2) - MAT(src,0,2) * MAT(src,1,1);
+	float a10 = MAT(src,1,2) * MAT(src,2,0) - MAT(src,1,0) * MAT(src,2,2);
+	float a11 = MAT(src,0,0) * MAT(src,2,2) - MAT(src,0,2) * MAT(src,2,0);
+	float a12 = MAT(src,0,2) * MAT(src,1,0) - MAT(src,0,0) * MAT(src,1,2);
+	float a20 = MAT(src,1,0) * MAT(src,2,1) - MAT(src,1,1) * MAT(src,2,0);
+	float a21 = MAT(src,0,1) * MAT(src,2,0) - MAT(src,0,0) * MAT(src,2,1);
+	float a22 = MAT(src,0,0) * MAT(src,1,1) - MAT(src,0,1) * MAT(src,1,0);
+
+	float det = MAT(src,0,0) * a00 + MAT(src,0,1) * a10 + MAT(src,0,2) * a20;
+	if (det == 0.0f)
+		return false;
+	float s = 1.0f / det;
+	float tx = MAT(src,0,3), ty = MAT(src,1,3), tz = MAT(src,2,3);
+
+	MAT(dst,0,0) = a00 * s; MAT(dst,0,1) = a01 * s; MAT(dst,0,2) = a02 * s;
+	MAT(dst,1,0) = a10 * s; MAT(dst,1,1) = a11 * s; MAT(dst,1,2) = a12 * s;
+	MAT(dst,2,0) = a20 * s; MAT(dst,2,1) = a21 * s; MAT(dst,2,2) = a22 * s;
+	MAT(dst,0,3) = -(MAT(dst,0,0) * tx + MAT(dst,0,1) * ty + MAT(dst,0,2) * tz);
+	MAT(dst,1,3) = -(MAT(dst,1,0) * tx + MAT(dst,1,1) * ty + MAT(dst,1,2) * tz);
+	MAT(dst,2,3) = -(MAT(dst,2,0) * tx + MAT(dst,2,1) * ty + MAT(dst,2,2) * tz);
+	MAT(dst,3,0) = 0.0f; MAT(dst,3,1) = 0.0f; MAT(dst,3,2) = 0.0f; MAT(dst,3,3) = 1.0f;
+
+	#undef MAT
+	return true;
+	}
+
+
+///////////////////////////////////////////////////////////////////////////////////////
+// Quaternions and dual quaternions
+void m3dSlerpQuaternion(M3DQuaternionf r, const M3DQuaternionf a, const M3DQuaternionf b, float t)
+	{
+	// q and -q are the same rotation, take the one on a's side
+	float cosine = m3dQuaternionDot(a, b);
+	float sign = 1.0f;
+	if (cosine < 0.0f) {
+		cosine = -cosine;
+		sign = -1.0f;
+		}
+
+	float wa, wb;
+	bool nlerp = cosine > 0.9995f;
+	if (nlerp) {
+		wa = 1.0f - t;
+		wb = t;
+		}
+	else {
+		float angle = float(acos(cosine));
+		float s = 1.0f / float(sin(angle));
+		wa = float(sin((1.0f - t) * angle)) * s;
+		wb = float(sin(t * angle)) * s;
+		}
+	wb *= sign;
+
+	for (int i = 0; i < 4; i++)
+		r[i] = wa * a[i] + wb * b[i];
+	if (nlerp)
+		m3dNormalizeQuaternion(r);
+	}
+
+void m3dQuaternionToMatrix33(M3DMatrix33f m, const M3DQuaternionf q)
+	{
+	#define M(row,col)  m[col*3+row]
+	float x = q[0], y = q[1], z = q[2], w = q[3];
+	float xx = x * x, yy = y * y, zz = z * z;
+	float xy = x * y, yz = y * z, zx = z * x;
+	float wx = w * x, wy = w * y, wz = w * z;
+
+	M(0,0) = 1.0f - 2.0f * (yy + zz);
+	M(0,1) = 2.0f * (xy - wz);
+	M(0,2) = 2.0f * (zx + wy);
+
+	M(1,0) = 2.0f * (xy + wz);
+	M(1,1) = 1.0f - 2.0f * (xx + zz);
+	M(1,2) = 2.0f * (yz - wx);
+
+	M(2,0) = 2.0f * (zx - wy);
+	M(2,1) = 2.0f * (yz + wx);
+	M(2,2) = 1.0f - 2.0f * (xx + yy);
+	#undef M
+	}
+
+void m3dQuaternionToMatrix44(M3DMatrix44f m, const M3DQuaternionf q)
+	{
+	M3DMatrix33f rotation;
+	m3dQuaternionToMatrix33(rotation, q);
+	for (int c = 0; c < 3; c++)
+		{
+		memcpy(m + c * 4, rotation + c * 3, sizeof(float) * 3);
+		m[c * 4 + 3] = 0.0f;
+		}
+	m[12] = m[13] = m[14] = 0.0f;
+	m[15] = 1.0f;
+	}
+
+// Shepperd's method: start from the largest of w, x, y and z so the
+// square root and the division stay well conditioned
+void m3dQuaternionFromMatrix44(M3DQuaternionf q, const M3DMatrix44f m)
+	{
+	#define M(row,col)  m[col*4+row]
+	float trace = M(0,0) + M(1,1) + M(2,2);
+	if (trace > 0.0f) {
+		float s = 2.0f * float(sqrt(trace + 1.0f));
+		q[3] = 0.25f * s;
+		q[0] = (M(2,1) - M(1,2)) / s;
+		q[1] = (M(0,2) - M(2,0)) / s;
+		q[2] = (M(1,0) - M(0,1)) / s;
+		}
+	else if (M(0,0) > M(1,1) && M(0,0) > M(2,2)) {
+		float s = 2.0f * float(sqrt(1.0f + M(0,0) - M(1,1) - M(2,2)));
+		q[3] = (M(2,1) - M(1,2)) / s;
+		q[0] = 0.25f * s;
+		q[1] = (M(0,1) + M(1,0)) / s;
+		q[2] = (M(0,2) + M(2,0)) / s;
+		}
+	else if (M(1,1) > M(2,2)) {
+		float s = 2.0f * float(sqrt(1.0f + M(1,1) - M(0,0) - M(2,2)));
+		q[3] = (M(0,2) - M(2,0)) / s;
+		q[0] = (M(0,1) + M(1,0)) / s;
+		q[1] = 0.25f * s;
+		q[2] = (M(1,2) + M(2,1)) / s;
+		}
+	else {
+		float s = 2.0f * float(sqrt(1.0f + M(2,2) - M(0,0) - M(1,1)));
+		q[3] = (M(1,0) - M(0,1)) / s;
+		q[0] = (M(0,2) + M(2,0)) / s;
+		q[1] = (M(1,2) + M(2,1)) / s;
+		q[2] = 0.25f * s;
+		}
+	#undef M
+	}
+
+void m3dNormalizeDualQuaternion(struct M3DDualQuaternionf* dq)
+	{
+	float s = 1.0f / float(sqrt(m3dQuaternionDot(dq->real, dq->real)));
+	for (int i = 0; i < 4; i++)
+		{
+		dq->real[i] *= s;
+		dq->dual[i] *= s;
+		}
+	float d = m3dQuaternionDot(dq->real, dq->dual);
+	for (int i = 0; i < 4; i++)
+		dq->dual[i] -= dq->real[i] * d;
+	}
+
+void m3dSclerpDualQuaternion(struct M3DDualQuaternionf* r, const struct M3DDualQuaternionf* a,
+							 const struct M3DDualQuaternionf* b, float t)
+	{
+	// relative motion from a to b, the short way round
+	struct M3DDualQuaternionf inverse, d, p;
+	m3dDualQuaternionConjugate(&inverse, a);
+	m3dDualQuaternionMultiply(&d, &inverse, b);
+	if (d.real[3] < 0.0f)
+		{
+		for (int i = 0; i < 4; i++)
+			{
+			d.real[i] = -d.real[i];
+			d.dual[i] = -d.dual[i];
+			}
+		}
+
+	// screw parameters: half angle, axis l, moment m and pitch
+	float s = float(sqrt(d.real[0] * d.real[0] + d.real[1] * d.real[1] + d.real[2] * d.real[2]));
+	float halfAngle = float(atan2(s, d.real[3]));
+	if (s < 1e-6f) {
+		// no rotation, only the translation is scaled
+		m3dLoadIdentityQuaternion(p.real);
+		for (int i = 0; i < 4; i++)
+			p.dual[i] = d.dual[i] * t;
+		}
+	else {
+		float invS = 1.0f / s;
+		float pitch = -2.0f * d.dual[3] * invS;
+		M3DVector3f l, moment;
+		for (int i = 0; i < 3; i++)
+			{
+			l[i] = d.real[i] * invS;
+			moment[i] = (d.dual[i] - l[i] * (0.5f * pitch * d.real[3])) * invS;
+			}
+
+		// d raised to the power t: same screw, t times the angle and pitch
+		float angle = halfAngle * t, halfPitch = 0.5f * pitch * t;
+		float sa = float(sin(angle)), ca = float(cos(angle));
+		for (int i = 0; i < 3; i++)
+			{
+			p.real[i] = l[i] * sa;
+			p.dual[i] = l[i] * (halfPitch * ca) + moment[i] * sa;
+			}
+		p.real[3] = ca;
+		p.dual[3] = -halfPitch * sa;
+		}
+	m3dDualQuaternionMultiply(r, a, &p);
+	}
+
+void m3dDualQuaternionToMatrix44(M3DMatrix44f m, const struct M3DDualQuaternionf* dq)
+	{
+	m3dQuaternionToMatrix44(m, dq->real);
+	m3dGetDualQuaternionTranslation(m + 12, dq);
+	}
+
+void m3dDualQuaternionFromMatrix44(struct M3DDualQuaternionf* dq, const M3DMatrix44f m)
+	{
+	M3DQuaternionf q;
+	m3dQuaternionFromMatrix44(q, m);
+	m3dDualQuaternionFromRotationTranslation(dq, q, m + 12);
+	}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////////////
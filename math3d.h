@@ -8,6 +8,10 @@
 
 #include <math.h>
 #include <memory.h>
+#include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 // Data structures and containers
@@ -17,6 +21,8 @@
 // compatibility of data files (more likely) that contain such structures across
 // compilers/platforms. Arrays are always tightly packed, and are more efficient 
 // for moving blocks of data around (usually).
+// Templated fixed size versions with value semantics, M3DVec and M3DMat,
+// are in math3d.hpp; the float and double pairs in math3d.cpp use them.
 typedef float	M3DVector3f[3];		// Vector of three floats (x, y, z)
 typedef double	M3DVector3d[3];		// Vector of three doubles (x, y, z)
 
@@ -398,7 +404,11 @@ inline void m3dInjectRotation(M3DMatrix44d dst, const M3DMatrix33d src)
 ////////////////////////////////////////////////////////////////////////////////
 // MultMatrix
 // Implemented in Math.cpp
+// The float version runs the SIMD kernel picked at startup (math3d_simd.cpp).
+// All kernels add in the same order as the scalar reference and are built
+// without FMA, so results are bitwise identical to it.
 void m3dMatrixMultiply44(M3DMatrix44f product, const M3DMatrix44f a, const M3DMatrix44f b);
+void m3dMatrixMultiply44Scalar(M3DMatrix44f product, const M3DMatrix44f a, const M3DMatrix44f b);
 void m3dMatrixMultiply44(M3DMatrix44d product, const M3DMatrix44d a, const M3DMatrix44d b);
 void m3dMatrixMultiply33(M3DMatrix33f product, const M3DMatrix33f a, const M3DMatrix33f b);
 void m3dMatrixMultiply33(M3DMatrix33d product, const M3DMatrix33d a, const M3DMatrix33d b);
@@ -428,12 +438,39 @@ __inline void m3dTransformVector3(M3DVector3d vOut, const M3DVector3d v, const M
 
 __inline void m3dTransformVector4(M3DVector4f vOut, const M3DVector4f v, const M3DMatrix44f m)
     {
+#ifdef __SSE2__
+    // one column at a time, same order of operations as below
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(m), _mm_set1_ps(v[0]));
+    x = _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(m + 4), _mm_set1_ps(v[1])));
+    x = _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(m + 8), _mm_set1_ps(v[2])));
+    x = _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(m + 12), _mm_set1_ps(v[3])));
+    _mm_storeu_ps(vOut, x);
+#else
     vOut[0] = m[0] * v[0] + m[4] * v[1] + m[8] *  v[2] + m[12] * v[3];	 
     vOut[1] = m[1] * v[0] + m[5] * v[1] + m[9] *  v[2] + m[13] * v[3];	
     vOut[2] = m[2] * v[0] + m[6] * v[1] + m[10] * v[2] + m[14] * v[3];	
 	vOut[3] = m[3] * v[0] + m[7] * v[1] + m[11] * v[2] + m[15] * v[3];
+#endif
     }
 
+// Batch versions for whole meshes (math3d_simd.cpp), same results as
+// m3dTransformVector3 per point. Strides are in bytes: sizeof(M3DVector3f)
+// for packed arrays (the vectorized path), anything else for interleaved
+// vertex buffers. out may be in. Large batches are split over threads
+// (OpenMP), and outputs larger than the cache are streamed past it.
+void m3dTransformPoints3(float* out, size_t outStride, const float* in, size_t inStride, size_t count,
+                         const M3DMatrix44f m);
+// Normals go through the inverse transpose of the upper 3x3 and are
+// optionally rescaled to unit length
+void m3dTransformNormals3(float* out, size_t outStride, const float* in, size_t inStride, size_t count,
+                          const M3DMatrix44f m, bool normalize);
+// Structure of arrays, in[k][i] is coordinate k of point i
+void m3dTransformPoints3SoA(float* const out[3], const float* const in[3], size_t count, const M3DMatrix44f m);
+void m3dTransformNormals3SoA(float* const out[3], const float* const in[3], size_t count, const M3DMatrix44f m,
+                             bool normalize);
+// Inverse transpose of the upper 3x3, the cofactors if it is singular
+void m3dGetNormalMatrix33(M3DMatrix33f normalMatrix, const M3DMatrix44f m);
+
 // Ditto above, but for doubles
 __inline void m3dTransformVector4(M3DVector4d vOut, const M3DVector4d v, const M3DMatrix44d m)
     {
@@ -526,9 +563,296 @@ inline void m3dTransposeMatrix44(M3DMatrix44f dst, const M3DMatrix44f src)
 { TRANSPOSE44(dst, src); }
 inline void m3dTransposeMatrix44(M3DMatrix44d dst, const M3DMatrix44d src)
 { TRANSPOSE44(dst, src); }
+// Float version dispatched like m3dMatrixMultiply44, bitwise identical to
+// the scalar reference
 bool m3dInvertMatrix44(M3DMatrix44f dst, const M3DMatrix44f src);
+bool m3dInvertMatrix44Scalar(M3DMatrix44f dst, const M3DMatrix44f src);
 bool m3dInvertMatrix44(M3DMatrix44d dst, const M3DMatrix44d src);
 
+// Affine only inverse: the bottom row of src must be 0 0 0 1. The upper
+// 3x3 is inverted by cofactors and the translation is carried through it,
+// a fraction of the cost of the elimination above. Returns false, leaving
+// dst alone, if the 3x3 is singular.
+bool m3dInvertAffineMatrix44(M3DMatrix44f dst, const M3DMatrix44f src);
+
+// Rigid only inverse (orthonormal rotation plus translation): transpose the
+// rotation and rotate the negated translation back. dst must not be src.
+inline void m3dInvertRigidMatrix44(M3DMatrix44f dst, const M3DMatrix44f src)
+	{
+	for (int r = 0; r < 3; r++)
+		{
+		for (int c = 0; c < 3; c++)
+			dst[c * 4 + r] = src[r * 4 + c];
+		dst[12 + r] = -(src[r * 4] * src[12] + src[r * 4 + 1] * src[13] + src[r * 4 + 2] * src[14]);
+		dst[r * 4 + 3] = 0.0f;
+		}
+	dst[15] = 1.0f;
+	}
+
+// Applies the inverse of a rigid matrix to a point without forming it,
+// vOut = R^T (v - t). Moves a point into the frame of a link.
+__inline void m3dInverseTransformVector3(M3DVector3f vOut, const M3DVector3f v, const M3DMatrix44f m)
+	{
+	float d0 = v[0] - m[12], d1 = v[1] - m[13], d2 = v[2] - m[14];
+	vOut[0] = m[0] * d0 + m[1] * d1 + m[2] * d2;
+	vOut[1] = m[4] * d0 + m[5] * d1 + m[6] * d2;
+	vOut[2] = m[8] * d0 + m[9] * d1 + m[10] * d2;
+	}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Rigid transforms - rotation plus translation, p' = R p + t, which is all
+// the arm chain ever produces. Composing takes 36 multiplies instead of 64
+// and inverting is a transpose.
+struct M3DRigidTransformf
+	{
+	M3DMatrix33f rotation;		// column major, orthonormal
+	M3DVector3f translation;
+	};
+
+inline void m3dLoadIdentityRigid(struct M3DRigidTransformf* x)
+	{
+	m3dLoadIdentity33(x->rotation);
+	x->translation[0] = x->translation[1] = x->translation[2] = 0.0f;
+	}
+
+// The bottom row of the 4x4 is assumed to be 0 0 0 1
+inline void m3dRigidFromMatrix44(struct M3DRigidTransformf* x, const M3DMatrix44f m)
+	{
+	m3dExtractRotation(x->rotation, m);
+	memcpy(x->translation, m + 12, sizeof(M3DVector3f));
+	}
+
+inline void m3dRigidToMatrix44(M3DMatrix44f m, const struct M3DRigidTransformf* x)
+	{
+	for (int c = 0; c < 3; c++)
+		{
+		memcpy(m + c * 4, x->rotation + c * 3, sizeof(M3DVector3f));
+		m[c * 4 + 3] = 0.0f;
+		}
+	memcpy(m + 12, x->translation, sizeof(M3DVector3f));
+	m[15] = 1.0f;
+	}
+
+// r = a * b, b applied first. r may be a or b.
+inline void m3dComposeRigid(struct M3DRigidTransformf* r, const struct M3DRigidTransformf* a,
+							const struct M3DRigidTransformf* b)
+	{
+	struct M3DRigidTransformf x;
+	m3dMatrixMultiply33(x.rotation, a->rotation, b->rotation);
+	m3dRotateVector(x.translation, b->translation, a->rotation);
+	m3dAddVectors3(x.translation, x.translation, a->translation);
+	*r = x;
+	}
+
+// dst may be src
+inline void m3dInvertRigid(struct M3DRigidTransformf* dst, const struct M3DRigidTransformf* src)
+	{
+	struct M3DRigidTransformf x;
+	const float* m = src->rotation;
+	const float* t = src->translation;
+	for (int r = 0; r < 3; r++)
+		{
+		for (int c = 0; c < 3; c++)
+			x.rotation[c * 3 + r] = m[r * 3 + c];
+		x.translation[r] = -(m[r * 3] * t[0] + m[r * 3 + 1] * t[1] + m[r * 3 + 2] * t[2]);
+		}
+	*dst = x;
+	}
+
+inline void m3dTransformPointRigid(M3DVector3f vOut, const M3DVector3f v, const struct M3DRigidTransformf* x)
+	{
+	const float* m = x->rotation;
+	vOut[0] = m[0] * v[0] + m[3] * v[1] + m[6] * v[2] + x->translation[0];
+	vOut[1] = m[1] * v[0] + m[4] * v[1] + m[7] * v[2] + x->translation[1];
+	vOut[2] = m[2] * v[0] + m[5] * v[1] + m[8] * v[2] + x->translation[2];
+	}
+
+// Inverse applied without forming it, vOut = R^T (v - t)
+inline void m3dInverseTransformPointRigid(M3DVector3f vOut, const M3DVector3f v,
+										  const struct M3DRigidTransformf* x)
+	{
+	const float* m = x->rotation;
+	float d0 = v[0] - x->translation[0], d1 = v[1] - x->translation[1], d2 = v[2] - x->translation[2];
+	vOut[0] = m[0] * d0 + m[1] * d1 + m[2] * d2;
+	vOut[1] = m[3] * d0 + m[4] * d1 + m[5] * d2;
+	vOut[2] = m[6] * d0 + m[7] * d1 + m[8] * d2;
+	}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Quaternions - (x, y, z, w), w is the real part. Unit quaternions are
+// rotations; composing two takes 16 multiplies and they interpolate
+// smoothly. Conversions and interpolation are in math3d.cpp.
+typedef float M3DQuaternionf[4];
+
+inline void m3dLoadIdentityQuaternion(M3DQuaternionf q)
+	{ q[0] = q[1] = q[2] = 0.0f; q[3] = 1.0f; }
+
+// Same rotation as m3dRotationMatrix44, one sin/cos of the half angle
+inline void m3dRotationQuaternion(M3DQuaternionf q, float angle, float x, float y, float z)
+	{
+	float mag = float(sqrt(x*x + y*y + z*z));
+	if (mag == 0.0f) {
+		m3dLoadIdentityQuaternion(q);
+		return;
+		}
+	float s = float(sin(angle * 0.5f)) / mag;
+	q[0] = x * s;
+	q[1] = y * s;
+	q[2] = z * s;
+	q[3] = float(cos(angle * 0.5f));
+	}
+
+// r = a * b, b applied first. r may be a or b.
+inline void m3dQuaternionMultiply(M3DQuaternionf r, const M3DQuaternionf a, const M3DQuaternionf b)
+	{
+#ifdef __SSE2__
+	// r = aw b + ax (bw, -bz, by, -bx) + ay (bz, bw, -bx, -by) + az (-by, bx, bw, -bz),
+	// added in the same order as below
+	__m128 vb = _mm_loadu_ps(b);
+	__m128 x = _mm_xor_ps(_mm_shuffle_ps(vb, vb, _MM_SHUFFLE(0, 1, 2, 3)), _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f));
+	__m128 y = _mm_xor_ps(_mm_shuffle_ps(vb, vb, _MM_SHUFFLE(1, 0, 3, 2)), _mm_set_ps(-0.0f, -0.0f, 0.0f, 0.0f));
+	__m128 z = _mm_xor_ps(_mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1)), _mm_set_ps(-0.0f, 0.0f, 0.0f, -0.0f));
+	__m128 v = _mm_mul_ps(_mm_set1_ps(a[3]), vb);
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(a[0]), x));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(a[1]), y));
+	v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(a[2]), z));
+	_mm_storeu_ps(r, v);
+#else
+	float x = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+	float y = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+	float z = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+	float w = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+	r[0] = x; r[1] = y; r[2] = z; r[3] = w;
+#endif
+	}
+
+// The inverse of a unit quaternion
+inline void m3dQuaternionConjugate(M3DQuaternionf r, const M3DQuaternionf q)
+	{ r[0] = -q[0]; r[1] = -q[1]; r[2] = -q[2]; r[3] = q[3]; }
+
+inline float m3dQuaternionDot(const M3DQuaternionf a, const M3DQuaternionf b)
+	{ return a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3]; }
+
+inline void m3dNormalizeQuaternion(M3DQuaternionf q)
+	{
+	float s = 1.0f / float(sqrt(m3dQuaternionDot(q, q)));
+	q[0] *= s; q[1] *= s; q[2] *= s; q[3] *= s;
+	}
+
+// vOut = q v q*, for unit q
+inline void m3dRotateVectorQuaternion(M3DVector3f vOut, const M3DVector3f v, const M3DQuaternionf q)
+	{
+	// t = 2 (q.xyz x v), v' = v + w t + q.xyz x t
+	float tx = 2.0f * (q[1] * v[2] - q[2] * v[1]);
+	float ty = 2.0f * (q[2] * v[0] - q[0] * v[2]);
+	float tz = 2.0f * (q[0] * v[1] - q[1] * v[0]);
+	vOut[0] = v[0] + q[3] * tx + (q[1] * tz - q[2] * ty);
+	vOut[1] = v[1] + q[3] * ty + (q[2] * tx - q[0] * tz);
+	vOut[2] = v[2] + q[3] * tz + (q[0] * ty - q[1] * tx);
+	}
+
+// Shortest arc, t in [0, 1]. Falls back to a normalized lerp when a and b
+// are nearly the same rotation. r may be a or b.
+void m3dSlerpQuaternion(M3DQuaternionf r, const M3DQuaternionf a, const M3DQuaternionf b, float t);
+
+// Unit quaternion to rotation matrix and back. The translation of the 4x4
+// is left at zero; the conversion back only reads the upper 3x3, which
+// must be a rotation.
+void m3dQuaternionToMatrix33(M3DMatrix33f m, const M3DQuaternionf q);
+void m3dQuaternionToMatrix44(M3DMatrix44f m, const M3DQuaternionf q);
+void m3dQuaternionFromMatrix44(M3DQuaternionf q, const M3DMatrix44f m);
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Dual quaternions - real + e dual, a rigid transform in 8 floats. real is
+// the rotation, dual is half the translation times the rotation. Composing
+// takes 48 multiplies against 64 for a 4x4 product.
+struct M3DDualQuaternionf
+	{
+	M3DQuaternionf real;
+	M3DQuaternionf dual;
+	};
+
+inline void m3dLoadIdentityDualQuaternion(struct M3DDualQuaternionf* dq)
+	{
+	m3dLoadIdentityQuaternion(dq->real);
+	dq->dual[0] = dq->dual[1] = dq->dual[2] = dq->dual[3] = 0.0f;
+	}
+
+// Rotation q followed by translation t
+inline void m3dDualQuaternionFromRotationTranslation(struct M3DDualQuaternionf* dq, const M3DQuaternionf q,
+													 const M3DVector3f t)
+	{
+	M3DQuaternionf pureT = { 0.5f * t[0], 0.5f * t[1], 0.5f * t[2], 0.0f };
+	memcpy(dq->real, q, sizeof(M3DQuaternionf));
+	m3dQuaternionMultiply(dq->dual, pureT, q);
+	}
+
+inline void m3dGetDualQuaternionTranslation(M3DVector3f t, const struct M3DDualQuaternionf* dq)
+	{
+	// t = 2 dual real*
+	M3DQuaternionf conjugate, x;
+	m3dQuaternionConjugate(conjugate, dq->real);
+	m3dQuaternionMultiply(x, dq->dual, conjugate);
+	t[0] = 2.0f * x[0];
+	t[1] = 2.0f * x[1];
+	t[2] = 2.0f * x[2];
+	}
+
+// r = a * b, b applied first. r may be a or b.
+inline void m3dDualQuaternionMultiply(struct M3DDualQuaternionf* r, const struct M3DDualQuaternionf* a,
+									  const struct M3DDualQuaternionf* b)
+	{
+	M3DQuaternionf real, dual, cross;
+	m3dQuaternionMultiply(real, a->real, b->real);
+	m3dQuaternionMultiply(dual, a->real, b->dual);
+	m3dQuaternionMultiply(cross, a->dual, b->real);
+	for (int i = 0; i < 4; i++)
+		{
+		r->real[i] = real[i];
+		r->dual[i] = dual[i] + cross[i];
+		}
+	}
+
+// Inverse of a unit dual quaternion: conjugate both parts
+inline void m3dDualQuaternionConjugate(struct M3DDualQuaternionf* r, const struct M3DDualQuaternionf* dq)
+	{
+	m3dQuaternionConjugate(r->real, dq->real);
+	m3dQuaternionConjugate(r->dual, dq->dual);
+	}
+
+inline void m3dTransformPointDualQuaternion(M3DVector3f vOut, const M3DVector3f v,
+											const struct M3DDualQuaternionf* dq)
+	{
+	M3DVector3f t, r;
+	m3dGetDualQuaternionTranslation(t, dq);
+	m3dRotateVectorQuaternion(r, v, dq->real);
+	m3dAddVectors3(vOut, r, t);
+	}
+
+// Rescales to unit length and makes the dual part orthogonal to the real
+// part again, to remove drift after long chains of products
+void m3dNormalizeDualQuaternion(struct M3DDualQuaternionf* dq);
+
+// Screw linear interpolation: constant speed rotation about and
+// translation along one screw axis, t in [0, 1]. r may be a or b.
+void m3dSclerpDualQuaternion(struct M3DDualQuaternionf* r, const struct M3DDualQuaternionf* a,
+							 const struct M3DDualQuaternionf* b, float t);
+
+// Rigid 4x4 matrix conversions
+void m3dDualQuaternionToMatrix44(M3DMatrix44f m, const struct M3DDualQuaternionf* dq);
+void m3dDualQuaternionFromMatrix44(struct M3DDualQuaternionf* dq, const M3DMatrix44f m);
+
+// Name of the kernels in use: "avx", "sse2" or "scalar"
+const char* m3dGetKernelName(void);
+// Compares the kernels in use against the scalar references on count
+// random matrices plus a few special ones (singular, signed zeros). On any
+// bit difference it reports it, switches to the scalar kernels and returns
+// false.
+bool m3dCheckKernels(int count);
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -570,8 +894,8 @@ void m3dProjectXYZ(M3DVector3f vPointOut, const M3DMatrix44f mModelView, const M
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 // This function does a three dimensional Catmull-Rom "spline" interpolation between p1 and p2
-void m3dCatmullRom(M3DVector3f vOut, M3DVector3f vP0, M3DVector3f vP1, M3DVector3f vP2, M3DVector3f vP3, float t);
-void m3dCatmullRom(M3DVector3d vOut, M3DVector3d vP0, M3DVector3d vP1, M3DVector3d vP2, M3DVector3d vP3, double t);
+void m3dCatmullRom3(M3DVector3f vOut, M3DVector3f vP0, M3DVector3f vP1, M3DVector3f vP2, M3DVector3f vP3, float t);
+void m3dCatmullRom3(M3DVector3d vOut, M3DVector3d vP0, M3DVector3d vP1, M3DVector3d vP2, M3DVector3d vP3, double t);
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 // Compare floats and doubles... 
@@ -0,0 +1,210 @@
+// Math3d.hpp
+// Fixed size vector and matrix templates for the Math3d library. The sizes
+// and the element type are template parameters, so one definition covers
+// float and double, and every loop has a trip count known at compile time
+// that the compiler unrolls (and vectorizes where it can).
+//
+// The types are plain aggregates holding a tightly packed array, laid out
+// exactly like the M3DVector and M3DMatrix typedefs (matrices column major).
+// They are passed and returned by value; load() and store() copy to and
+// from the raw arrays, so code working on locals never has to assume that
+// two pointers overlap. Sums are evaluated left to right in index order,
+// the same order as the hand written m3d functions, so results match them
+// bit for bit.
+//
+// Operators evaluate eagerly; there are no expression templates. With three
+// or four elements the temporaries of a + b * s - c stay in registers at -O2
+// and the result compiles to the same code as the fused loop, while a lazy
+// expression would hold references that dangle once stored with auto.
+#ifndef _MATH3D_TEMPLATES__
+#define _MATH3D_TEMPLATES__
+
+#include <math.h>
+#include <string.h>
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Vector of N elements
+template <int N, typename T>
+struct M3DVec
+	{
+	T v[N];
+
+	constexpr T& operator[](int i) { return v[i]; }
+	constexpr const T& operator[](int i) const { return v[i]; }
+
+	static M3DVec load(const T* src)
+		{ M3DVec r; memcpy(r.v, src, sizeof(r.v)); return r; }
+	void store(T* dst) const
+		{ memcpy(dst, v, sizeof(v)); }
+	};
+
+typedef M3DVec<2, float>	M3DVec2f;
+typedef M3DVec<2, double>	M3DVec2d;
+typedef M3DVec<3, float>	M3DVec3f;
+typedef M3DVec<3, double>	M3DVec3d;
+typedef M3DVec<4, float>	M3DVec4f;
+typedef M3DVec<4, double>	M3DVec4d;
+
+template <int N, typename T>
+constexpr M3DVec<N, T> operator+(const M3DVec<N, T>& a, const M3DVec<N, T>& b)
+	{ M3DVec<N, T> r = {}; for (int i = 0; i < N; i++) r[i] = a[i] + b[i]; return r; }
+
+template <int N, typename T>
+constexpr M3DVec<N, T> operator-(const M3DVec<N, T>& a, const M3DVec<N, T>& b)
+	{ M3DVec<N, T> r = {}; for (int i = 0; i < N; i++) r[i] = a[i] - b[i]; return r; }
+
+template <int N, typename T>
+constexpr M3DVec<N, T> operator-(const M3DVec<N, T>& a)
+	{ M3DVec<N, T> r = {}; for (int i = 0; i < N; i++) r[i] = -a[i]; return r; }
+
+template <int N, typename T>
+constexpr M3DVec<N, T> operator*(const M3DVec<N, T>& a, T s)
+	{ M3DVec<N, T> r = {}; for (int i = 0; i < N; i++) r[i] = a[i] * s; return r; }
+
+template <int N, typename T>
+constexpr M3DVec<N, T> operator*(T s, const M3DVec<N, T>& a)
+	{ return a * s; }
+
+template <int N, typename T>
+constexpr T m3dDot(const M3DVec<N, T>& a, const M3DVec<N, T>& b)
+	{ T r = a[0] * b[0]; for (int i = 1; i < N; i++) r += a[i] * b[i]; return r; }
+
+template <typename T>
+constexpr M3DVec<3, T> m3dCross(const M3DVec<3, T>& u, const M3DVec<3, T>& v)
+	{
+	M3DVec<3, T> r = {{ u[1] * v[2] - v[1] * u[2],
+						-u[0] * v[2] + v[0] * u[2],
+						u[0] * v[1] - v[0] * u[1] }};
+	return r;
+	}
+
+template <int N, typename T>
+constexpr T m3dLengthSquared(const M3DVec<N, T>& a)
+	{ return m3dDot(a, a); }
+
+template <int N, typename T>
+inline T m3dLength(const M3DVec<N, T>& a)
+	{ return T(sqrt(m3dLengthSquared(a))); }
+
+template <int N, typename T>
+constexpr T m3dDistanceSquared(const M3DVec<N, T>& a, const M3DVec<N, T>& b)
+	{
+	// difference squared first, then summed, as m3dGetDistanceSquared
+	T d[N] = {};
+	for (int i = 0; i < N; i++) { d[i] = a[i] - b[i]; d[i] = d[i] * d[i]; }
+	T r = d[0];
+	for (int i = 1; i < N; i++) r += d[i];
+	return r;
+	}
+
+template <int N, typename T>
+inline M3DVec<N, T> m3dNormalize(const M3DVec<N, T>& a)
+	{ return a * (T(1) / m3dLength(a)); }
+
+
+///////////////////////////////////////////////////////////////////////////////
+// R x C matrix, column major like the M3DMatrix typedefs and OpenGL
+template <int R, int C, typename T>
+struct M3DMat
+	{
+	T m[R * C];
+
+	constexpr T& operator()(int row, int col) { return m[col * R + row]; }
+	constexpr const T& operator()(int row, int col) const { return m[col * R + row]; }
+
+	static M3DMat load(const T* src)
+		{ M3DMat r; memcpy(r.m, src, sizeof(r.m)); return r; }
+	void store(T* dst) const
+		{ memcpy(dst, m, sizeof(m)); }
+
+	static constexpr M3DMat identity()
+		{
+		M3DMat r = {};
+		for (int i = 0; i < (R < C ? R : C); i++) r(i, i) = T(1);
+		return r;
+		}
+	};
+
+typedef M3DMat<3, 3, float>		M3DMat33f;
+typedef M3DMat<3, 3, double>	M3DMat33d;
+typedef M3DMat<4, 4, float>		M3DMat44f;
+typedef M3DMat<4, 4, double>	M3DMat44d;
+
+// Product(i, j) = a(i, 0) * b(0, j) + a(i, 1) * b(1, j) + ...
+// Accumulated a whole column at a time, columns of a scaled by elements of
+// b, so the inner loop runs down contiguous memory and vectorizes.
+template <int R, int K, int C, typename T>
+constexpr M3DMat<R, C, T> operator*(const M3DMat<R, K, T>& a, const M3DMat<K, C, T>& b)
+	{
+	M3DMat<R, C, T> p = {};
+	for (int j = 0; j < C; j++)
+		{
+		for (int i = 0; i < R; i++) p(i, j) = a(i, 0) * b(0, j);
+		for (int k = 1; k < K; k++)
+			for (int i = 0; i < R; i++) p(i, j) += a(i, k) * b(k, j);
+		}
+	return p;
+	}
+
+template <int R, int C, typename T>
+constexpr M3DVec<R, T> operator*(const M3DMat<R, C, T>& a, const M3DVec<C, T>& v)
+	{
+	M3DVec<R, T> r = {};
+	for (int i = 0; i < R; i++) r[i] = a(i, 0) * v[0];
+	for (int k = 1; k < C; k++)
+		for (int i = 0; i < R; i++) r[i] += a(i, k) * v[k];
+	return r;
+	}
+
+template <int R, int C, typename T>
+constexpr M3DMat<C, R, T> m3dTranspose(const M3DMat<R, C, T>& a)
+	{
+	M3DMat<C, R, T> r = {};
+	for (int i = 0; i < R; i++)
+		for (int j = 0; j < C; j++) r(j, i) = a(i, j);
+	return r;
+	}
+
+// Point through a 4x4 with an implied w of 1, as m3dTransformVector3
+template <typename T>
+constexpr M3DVec<3, T> m3dTransformPoint(const M3DMat<4, 4, T>& a, const M3DVec<3, T>& v)
+	{
+	M3DVec<3, T> r = {};
+	for (int i = 0; i < 3; i++)
+		r[i] = a(i, 0) * v[0] + a(i, 1) * v[1] + a(i, 2) * v[2] + a(i, 3);
+	return r;
+	}
+
+// Upper 3x3 and translation column of a 4x4
+template <typename T>
+constexpr M3DMat<3, 3, T> m3dGetRotation(const M3DMat<4, 4, T>& a)
+	{
+	M3DMat<3, 3, T> r = {};
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++) r(i, j) = a(i, j);
+	return r;
+	}
+
+template <typename T>
+constexpr M3DVec<3, T> m3dGetTranslation(const M3DMat<4, 4, T>& a)
+	{
+	M3DVec<3, T> r = {{ a(0, 3), a(1, 3), a(2, 3) }};
+	return r;
+	}
+
+// [rotation translation; 0 0 0 1]
+template <typename T>
+constexpr M3DMat<4, 4, T> m3dMakeRigid(const M3DMat<3, 3, T>& rotation, const M3DVec<3, T>& translation)
+	{
+	M3DMat<4, 4, T> r = M3DMat<4, 4, T>::identity();
+	for (int i = 0; i < 3; i++)
+		{
+		for (int j = 0; j < 3; j++) r(i, j) = rotation(i, j);
+		r(i, 3) = translation[i];
+		}
+	return r;
+	}
+
+
+#endif
@@ -0,0 +1,627 @@
+// SIMD kernels for the hot float 4x4 operations of math3d, picked once at
+// startup. SSE2 is part of x86-64, so it is used whenever the compiler
+// targets it; AVX is detected at run time. Every kernel does the same
+// operations in the same order as the scalar reference in math3d.cpp and
+// none is built with FMA, so the results are bitwise identical.
+#include "math3d.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define M3D_HAVE_AVX 1
+#include <immintrin.h>
+#endif
+
+struct M3DKernels
+{
+    const char* name;
+    void (*multiply44)(M3DMatrix44f product, const M3DMatrix44f a, const M3DMatrix44f b);
+    bool (*invert44)(M3DMatrix44f dst, const M3DMatrix44f src);
+};
+
+#ifdef __SSE2__
+
+static void multiply44SSE2(M3DMatrix44f product, const M3DMatrix44f a, const M3DMatrix44f b)
+{
+    __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+    // load all of b first, product may alias either input
+    __m128 columns[4];
+    for (int j = 0; j < 4; ++j)
+        columns[j] = _mm_loadu_ps(b + j * 4);
+    for (int j = 0; j < 4; ++j)
+    {
+        __m128 bj = columns[j];
+        __m128 p = _mm_mul_ps(a0, _mm_shuffle_ps(bj, bj, _MM_SHUFFLE(0, 0, 0, 0)));
+        p = _mm_add_ps(p, _mm_mul_ps(a1, _mm_shuffle_ps(bj, bj, _MM_SHUFFLE(1, 1, 1, 1))));
+        p = _mm_add_ps(p, _mm_mul_ps(a2, _mm_shuffle_ps(bj, bj, _MM_SHUFFLE(2, 2, 2, 2))));
+        p = _mm_add_ps(p, _mm_mul_ps(a3, _mm_shuffle_ps(bj, bj, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm_storeu_ps(product + j * 4, p);
+    }
+}
+
+template <int i>
+static inline float getLane(__m128 v)
+{
+    return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(i, i, i, i)));
+}
+
+static inline void swapRows(__m128* a, __m128* b)
+{
+    __m128 t = a[0]; a[0] = b[0]; b[0] = t;
+    t = a[1]; a[1] = b[1]; b[1] = t;
+}
+
+// row -= m * pivot. The reference skips the right half entries where the
+// pivot row is 0, which matters for the sign of zero results.
+static inline void eliminateRow(__m128* row, float m, const __m128* pivot)
+{
+    __m128 mm = _mm_set1_ps(m);
+    row[0] = _mm_sub_ps(row[0], _mm_mul_ps(mm, pivot[0]));
+    __m128 keep = _mm_cmpeq_ps(pivot[1], _mm_setzero_ps());
+    __m128 updated = _mm_sub_ps(row[1], _mm_mul_ps(mm, pivot[1]));
+    row[1] = _mm_or_ps(_mm_and_ps(keep, row[1]), _mm_andnot_ps(keep, updated));
+}
+
+// Gauss-Jordan elimination of m3dInvertMatrix44Scalar, rows of [src | I]
+// held as two registers each
+static bool invert44SSE2(M3DMatrix44f dst, const M3DMatrix44f src)
+{
+    __m128 c0 = _mm_loadu_ps(src), c1 = _mm_loadu_ps(src + 4), c2 = _mm_loadu_ps(src + 8),
+           c3 = _mm_loadu_ps(src + 12);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    __m128 rows[4][2] = {
+        { c0, _mm_setr_ps(1.0f, 0.0f, 0.0f, 0.0f) },
+        { c1, _mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f) },
+        { c2, _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f) },
+        { c3, _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f) }
+    };
+    __m128 *r0 = rows[0], *r1 = rows[1], *r2 = rows[2], *r3 = rows[3];
+
+    // choose pivot - or die
+    if (fabs(getLane<0>(r3[0])) > fabs(getLane<0>(r2[0]))) swapRows(r3, r2);
+    if (fabs(getLane<0>(r2[0])) > fabs(getLane<0>(r1[0]))) swapRows(r2, r1);
+    if (fabs(getLane<0>(r1[0])) > fabs(getLane<0>(r0[0]))) swapRows(r1, r0);
+    float p = getLane<0>(r0[0]);
+    if (0.0 == p) return false;
+    // the first column of r1..r3 is never read again
+    float m1 = getLane<0>(r1[0]) / p, m2 = getLane<0>(r2[0]) / p, m3 = getLane<0>(r3[0]) / p;
+    eliminateRow(r1, m1, r0);
+    eliminateRow(r2, m2, r0);
+    eliminateRow(r3, m3, r0);
+
+    if (fabs(getLane<1>(r3[0])) > fabs(getLane<1>(r2[0]))) swapRows(r3, r2);
+    if (fabs(getLane<1>(r2[0])) > fabs(getLane<1>(r1[0]))) swapRows(r2, r1);
+    p = getLane<1>(r1[0]);
+    if (0.0 == p) return false;
+    m2 = getLane<1>(r2[0]) / p;
+    m3 = getLane<1>(r3[0]) / p;
+    eliminateRow(r2, m2, r1);
+    eliminateRow(r3, m3, r1);
+
+    if (fabs(getLane<2>(r3[0])) > fabs(getLane<2>(r2[0]))) swapRows(r3, r2);
+    p = getLane<2>(r2[0]);
+    if (0.0 == p) return false;
+    m3 = getLane<2>(r3[0]) / p;
+    __m128 mm = _mm_set1_ps(m3);
+    r3[0] = _mm_sub_ps(r3[0], _mm_mul_ps(mm, r2[0]));
+    r3[1] = _mm_sub_ps(r3[1], _mm_mul_ps(mm, r2[1]));
+
+    if (0.0 == getLane<3>(r3[0])) return false;
+
+    // back substitution only touches the right half, take the left half
+    // factors first
+    float l0[4], l1[4], l2[4], l3[4];
+    _mm_storeu_ps(l0, r0[0]);
+    _mm_storeu_ps(l1, r1[0]);
+    _mm_storeu_ps(l2, r2[0]);
+    _mm_storeu_ps(l3, r3[0]);
+    __m128 x0 = r0[1], x1 = r1[1], x2 = r2[1], x3 = r3[1];
+
+    x3 = _mm_mul_ps(x3, _mm_set1_ps(1.0f / l3[3]));
+    x2 = _mm_mul_ps(_mm_set1_ps(1.0f / l2[2]), _mm_sub_ps(x2, _mm_mul_ps(x3, _mm_set1_ps(l2[3]))));
+    x1 = _mm_sub_ps(x1, _mm_mul_ps(x3, _mm_set1_ps(l1[3])));
+    x0 = _mm_sub_ps(x0, _mm_mul_ps(x3, _mm_set1_ps(l0[3])));
+
+    x1 = _mm_mul_ps(_mm_set1_ps(1.0f / l1[1]), _mm_sub_ps(x1, _mm_mul_ps(x2, _mm_set1_ps(l1[2]))));
+    x0 = _mm_sub_ps(x0, _mm_mul_ps(x2, _mm_set1_ps(l0[2])));
+
+    x0 = _mm_mul_ps(_mm_set1_ps(1.0f / l0[0]), _mm_sub_ps(x0, _mm_mul_ps(x1, _mm_set1_ps(l0[1]))));
+
+    // row i of the inverse is x_i, store it column major
+    _MM_TRANSPOSE4_PS(x0, x1, x2, x3);
+    _mm_storeu_ps(dst, x0);
+    _mm_storeu_ps(dst + 4, x1);
+    _mm_storeu_ps(dst + 8, x2);
+    _mm_storeu_ps(dst + 12, x3);
+    return true;
+}
+
+#endif
+
+#ifdef M3D_HAVE_AVX
+
+// Two product columns per instruction
+__attribute__((target("avx")))
+static void multiply44AVX(M3DMatrix44f product, const M3DMatrix44f a, const M3DMatrix44f b)
+{
+    __m256 a0 = _mm256_broadcast_ps((const __m128*)a), a1 = _mm256_broadcast_ps((const __m128*)(a + 4)),
+           a2 = _mm256_broadcast_ps((const __m128*)(a + 8)), a3 = _mm256_broadcast_ps((const __m128*)(a + 12));
+    __m256 b01 = _mm256_loadu_ps(b), b23 = _mm256_loadu_ps(b + 8);
+    __m256 p01 = _mm256_mul_ps(a0, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(0, 0, 0, 0)));
+    __m256 p23 = _mm256_mul_ps(a0, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(0, 0, 0, 0)));
+    p01 = _mm256_add_ps(p01, _mm256_mul_ps(a1, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(1, 1, 1, 1))));
+    p23 = _mm256_add_ps(p23, _mm256_mul_ps(a1, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(1, 1, 1, 1))));
+    p01 = _mm256_add_ps(p01, _mm256_mul_ps(a2, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(2, 2, 2, 2))));
+    p23 = _mm256_add_ps(p23, _mm256_mul_ps(a2, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(2, 2, 2, 2))));
+    p01 = _mm256_add_ps(p01, _mm256_mul_ps(a3, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(3, 3, 3, 3))));
+    p23 = _mm256_add_ps(p23, _mm256_mul_ps(a3, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(3, 3, 3, 3))));
+    _mm256_storeu_ps(product, p01);
+    _mm256_storeu_ps(product + 8, p23);
+}
+
+#endif
+
+static const M3DKernels scalarKernels = { "scalar", m3dMatrixMultiply44Scalar, m3dInvertMatrix44Scalar };
+
+// Constant initialized, valid even for callers in other static initializers
+static M3DKernels kernels = scalarKernels;
+
+static int selectKernels(void)
+{
+#ifdef __SSE2__
+    kernels.name = "sse2";
+    kernels.multiply44 = multiply44SSE2;
+    kernels.invert44 = invert44SSE2;
+#endif
+#ifdef M3D_HAVE_AVX
+    // may run before the runtime initialized its CPU model
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+    {
+        // a whole [src | I] row fits one register, but the masked updates
+        // made that inversion slower than the SSE2 one
+        kernels.name = "avx";
+        kernels.multiply44 = multiply44AVX;
+    }
+#endif
+    return 1;
+}
+
+static int kernelsSelected = selectKernels();
+
+void m3dMatrixMultiply44(M3DMatrix44f product, const M3DMatrix44f a, const M3DMatrix44f b)
+{
+    kernels.multiply44(product, a, b);
+}
+
+bool m3dInvertMatrix44(M3DMatrix44f dst, const M3DMatrix44f src)
+{
+    return kernels.invert44(dst, src);
+}
+
+const char* m3dGetKernelName(void)
+{
+    return kernels.name;
+}
+
+// own generator, leaves the rand() sequence of the caller alone
+static float getRandomFloat(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (float)(*state >> 8) * (200.0f / 16777216.0f) - 100.0f;
+}
+
+bool m3dCheckKernels(int count)
+{
+    (void)kernelsSelected;
+    if (kernels.multiply44 == scalarKernels.multiply44)
+        return true;
+
+    // a few matrices the elimination treats specially: singular, zeros of
+    // both signs, rows that need pivoting
+    M3DMatrix44f special[4];
+    m3dLoadIdentity44(special[0]);
+    memset(special[1], 0, sizeof(special[1]));
+    special[1][1] = special[1][4] = special[1][10] = special[1][15] = -1.0f;
+    special[1][3] = -0.0f;
+    memcpy(special[2], special[0], sizeof(special[2]));
+    special[2][5] = 0.0f;
+    m3dRotationMatrix44(special[3], 1.0f, 0.0f, 1.0f, 0.0f);
+    special[3][12] = -0.0f;
+
+    uint32_t state = 1;
+    for (int i = 0; i < count + 4; ++i)
+    {
+        M3DMatrix44f a, b, expected, actual;
+        if (i < 4)
+        {
+            memcpy(a, special[i], sizeof(a));
+            memcpy(b, special[(i + 1) % 4], sizeof(b));
+        }
+        else
+        {
+            for (int k = 0; k < 16; ++k)
+            {
+                a[k] = getRandomFloat(&state);
+                b[k] = getRandomFloat(&state);
+            }
+        }
+
+        m3dMatrixMultiply44Scalar(expected, a, b);
+        kernels.multiply44(actual, a, b);
+        bool same = memcmp(expected, actual, sizeof(expected)) == 0;
+
+        memset(expected, 0, sizeof(expected));
+        memset(actual, 0, sizeof(actual));
+        bool expectedOk = m3dInvertMatrix44Scalar(expected, a);
+        bool actualOk = kernels.invert44(actual, a);
+        same = same && expectedOk == actualOk && memcmp(expected, actual, sizeof(expected)) == 0;
+
+        if (!same)
+        {
+            fprintf(stderr, "math3d %s kernels differ from the scalar reference on matrix %d, using scalar\n",
+                    kernels.name, i);
+            kernels = scalarKernels;
+            return false;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Batch transforms. Each point is done in the order of m3dTransformVector3,
+// so the results match it exactly.
+
+// points per OpenMP task, a multiple of 4 so the SIMD blocks stay aligned
+#define M3D_BATCH_CHUNK 65536
+// outputs larger than this are written around the cache
+#define M3D_STREAM_BYTES (8u << 20)
+
+// Upper 3x3 of a transform (or its inverse transpose for normals) and the
+// translation, column major like the source matrix
+struct BatchTransform
+{
+    float m[3][3];
+    float t[3];
+    bool translate;
+    bool normalize;
+};
+
+void m3dGetNormalMatrix33(M3DMatrix33f normalMatrix, const M3DMatrix44f m)
+{
+    // inverse transpose = cofactor matrix / determinant
+    #define M(row, col) m[(col) * 4 + (row)]
+    #define N(row, col) normalMatrix[(col) * 3 + (row)]
+    N(0, 0) = M(1, 1) * M(2, 2) - M(1, 2) * M(2, 1);
+    N(0, 1) = M(1, 2) * M(2, 0) - M(1, 0) * M(2, 2);
+    N(0, 2) = M(1, 0) * M(2, 1) - M(1, 1) * M(2, 0);
+    N(1, 0) = M(0, 2) * M(2, 1) - M(0, 1) * M(2, 2);
+    N(1, 1) = M(0, 0) * M(2, 2) - M(0, 2) * M(2, 0);
+    N(1, 2) = M(0, 1) * M(2, 0) - M(0, 0) * M(2, 1);
+    N(2, 0) = M(0, 1) * M(1, 2) - M(0, 2) * M(1, 1);
+    N(2, 1) = M(0, 2) * M(1, 0) - M(0, 0) * M(1, 2);
+    N(2, 2) = M(0, 0) * M(1, 1) - M(0, 1) * M(1, 0);
+    float det = M(0, 0) * N(0, 0) + M(0, 1) * N(0, 1) + M(0, 2) * N(0, 2);
+    // a singular matrix keeps the cofactors, they still give the direction
+    if (det != 0.0f)
+    {
+        float inverseDet = 1.0f / det;
+        for (int i = 0; i < 9; ++i)
+            normalMatrix[i] *= inverseDet;
+    }
+    #undef M
+    #undef N
+}
+
+static void getPointTransform(struct BatchTransform* transform, const M3DMatrix44f m)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int r = 0; r < 3; ++r)
+            transform->m[c][r] = m[c * 4 + r];
+        transform->t[c] = m[12 + c];
+    }
+    transform->translate = true;
+    transform->normalize = false;
+}
+
+static void getNormalTransform(struct BatchTransform* transform, const M3DMatrix44f m, bool normalize)
+{
+    M3DMatrix33f normalMatrix;
+    m3dGetNormalMatrix33(normalMatrix, m);
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int r = 0; r < 3; ++r)
+            transform->m[c][r] = normalMatrix[c * 3 + r];
+        transform->t[c] = 0.0f;
+    }
+    transform->translate = false;
+    transform->normalize = normalize;
+}
+
+static inline void transformOne(const struct BatchTransform* transform, const float* in, float* out)
+{
+    float x = in[0], y = in[1], z = in[2];
+    const float (*m)[3] = transform->m;
+    float v[3];
+    for (int r = 0; r < 3; ++r)
+    {
+        v[r] = m[0][r] * x + m[1][r] * y + m[2][r] * z;
+        if (transform->translate)
+            v[r] += transform->t[r];
+    }
+    if (transform->normalize)
+    {
+        float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (length > 0.0f)
+        {
+            float scale = 1.0f / length;
+            v[0] *= scale;
+            v[1] *= scale;
+            v[2] *= scale;
+        }
+    }
+    out[0] = v[0];
+    out[1] = v[1];
+    out[2] = v[2];
+}
+
+#ifdef __SSE2__
+
+// The transform broadcast once per batch. Named fields rather than arrays
+// so that the compiler keeps them in registers.
+struct BatchRegisters
+{
+    __m128 m00, m01, m02, m10, m11, m12, m20, m21, m22;
+    __m128 t0, t1, t2;
+};
+
+static inline struct BatchRegisters getBatchRegisters(const struct BatchTransform* transform)
+{
+    const float (*m)[3] = transform->m;
+    struct BatchRegisters registers = {
+        _mm_set1_ps(m[0][0]), _mm_set1_ps(m[0][1]), _mm_set1_ps(m[0][2]),
+        _mm_set1_ps(m[1][0]), _mm_set1_ps(m[1][1]), _mm_set1_ps(m[1][2]),
+        _mm_set1_ps(m[2][0]), _mm_set1_ps(m[2][1]), _mm_set1_ps(m[2][2]),
+        _mm_set1_ps(transform->t[0]), _mm_set1_ps(transform->t[1]), _mm_set1_ps(transform->t[2])
+    };
+    return registers;
+}
+
+// Four points in place, as registers of x, y and z
+template <bool translate, bool normalize>
+static inline void transformBlock(const struct BatchRegisters& r, __m128& x, __m128& y, __m128& z)
+{
+    __m128 v0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r.m00, x), _mm_mul_ps(r.m10, y)), _mm_mul_ps(r.m20, z));
+    __m128 v1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r.m01, x), _mm_mul_ps(r.m11, y)), _mm_mul_ps(r.m21, z));
+    __m128 v2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r.m02, x), _mm_mul_ps(r.m12, y)), _mm_mul_ps(r.m22, z));
+    if (translate)
+    {
+        v0 = _mm_add_ps(v0, r.t0);
+        v1 = _mm_add_ps(v1, r.t1);
+        v2 = _mm_add_ps(v2, r.t2);
+    }
+    if (normalize)
+    {
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(v0, v0), _mm_mul_ps(v1, v1)),
+                                               _mm_mul_ps(v2, v2)));
+        // zero length: scale 1 leaves the vector alone
+        __m128 zero = _mm_cmpeq_ps(length, _mm_setzero_ps());
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 scale = _mm_div_ps(one, _mm_or_ps(_mm_and_ps(zero, one), _mm_andnot_ps(zero, length)));
+        v0 = _mm_mul_ps(v0, scale);
+        v1 = _mm_mul_ps(v1, scale);
+        v2 = _mm_mul_ps(v2, scale);
+    }
+    x = v0;
+    y = v1;
+    z = v2;
+}
+
+template <bool stream>
+static inline void storeBlock(float* out, __m128 v)
+{
+    if (stream)
+        _mm_stream_ps(out, v);
+    else
+        _mm_storeu_ps(out, v);
+}
+
+// Packed x, y, z triples, four at a time. Returns the number done.
+template <bool translate, bool normalize, bool stream>
+static size_t transformPackedSSE2(const struct BatchTransform* transform, float* out, const float* in, size_t count)
+{
+    const struct BatchRegisters registers = getBatchRegisters(transform);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const float* p = in + i * 3;
+        __m128 p0 = _mm_loadu_ps(p), p1 = _mm_loadu_ps(p + 4), p2 = _mm_loadu_ps(p + 8);
+        // x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3 to x, y and z registers
+        __m128 x = _mm_shuffle_ps(p0, _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+        __m128 y = _mm_shuffle_ps(_mm_shuffle_ps(p0, p1, _MM_SHUFFLE(0, 0, 1, 1)),
+                                  _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(p0, p1, _MM_SHUFFLE(1, 1, 2, 2)), p2, _MM_SHUFFLE(3, 0, 2, 0));
+        transformBlock<translate, normalize>(registers, x, y, z);
+        // and back
+        __m128 q0 = _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)),
+                                   _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 q1 = _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)),
+                                   _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 q2 = _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)),
+                                   _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        float* q = out + i * 3;
+        storeBlock<stream>(q, q0);
+        storeBlock<stream>(q + 4, q1);
+        storeBlock<stream>(q + 8, q2);
+    }
+    return i;
+}
+
+template <bool translate, bool normalize, bool stream>
+static size_t transformSoASSE2(const struct BatchTransform* transform, float* const out[3],
+                               const float* const in[3], size_t first, size_t end)
+{
+    const struct BatchRegisters registers = getBatchRegisters(transform);
+    float *outX = out[0], *outY = out[1], *outZ = out[2];
+    const float *inX = in[0], *inY = in[1], *inZ = in[2];
+    size_t i = first;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(inX + i), y = _mm_loadu_ps(inY + i), z = _mm_loadu_ps(inZ + i);
+        transformBlock<translate, normalize>(registers, x, y, z);
+        storeBlock<stream>(outX + i, x);
+        storeBlock<stream>(outY + i, y);
+        storeBlock<stream>(outZ + i, z);
+    }
+    return i;
+}
+
+// Picks the instantiation for the run time flags
+#define M3D_BATCH_DISPATCH(function, transform, stream, ...)                                   \
+    ((transform)->translate                                                                    \
+         ? ((stream) ? function<true, false, true>(transform, __VA_ARGS__)                     \
+                     : function<true, false, false>(transform, __VA_ARGS__))                   \
+         : (transform)->normalize                                                              \
+               ? ((stream) ? function<false, true, true>(transform, __VA_ARGS__)               \
+                           : function<false, true, false>(transform, __VA_ARGS__))             \
+               : ((stream) ? function<false, false, true>(transform, __VA_ARGS__)              \
+                           : function<false, false, false>(transform, __VA_ARGS__)))
+
+#endif
+
+// Packed x, y, z triples
+static void transformPacked(const struct BatchTransform* transform, float* out, const float* in, size_t count,
+                            bool stream)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    i = M3D_BATCH_DISPATCH(transformPackedSSE2, transform, stream, out, in, count);
+#endif
+    for (; i < count; ++i)
+        transformOne(transform, in + i * 3, out + i * 3);
+}
+
+static void transformStrided(const struct BatchTransform* transform, float* out, size_t outStride,
+                             const float* in, size_t inStride, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        transformOne(transform, (const float*)((const char*)in + i * inStride),
+                     (float*)((char*)out + i * outStride));
+}
+
+// Points [first, first + n) of an AoS batch
+static void transformAoSChunk(const struct BatchTransform* transform, float* out, size_t outStride,
+                              const float* in, size_t inStride, size_t first, size_t n, bool stream)
+{
+    out = (float*)((char*)out + first * outStride);
+    in = (const float*)((const char*)in + first * inStride);
+    if (outStride == sizeof(M3DVector3f) && inStride == sizeof(M3DVector3f))
+        transformPacked(transform, out, in, n, stream);
+    else
+        transformStrided(transform, out, outStride, in, inStride, n);
+}
+
+static void transformSoAChunk(const struct BatchTransform* transform, float* const out[3],
+                              const float* const in[3], size_t i, size_t end, bool stream)
+{
+#ifdef __SSE2__
+    i = M3D_BATCH_DISPATCH(transformSoASSE2, transform, stream, out, in, i, end);
+#endif
+    for (; i < end; ++i)
+    {
+        float p[3] = { in[0][i], in[1][i], in[2][i] }, q[3];
+        transformOne(transform, p, q);
+        out[0][i] = q[0];
+        out[1][i] = q[1];
+        out[2][i] = q[2];
+    }
+}
+
+// Batches of one chunk, the common case for small meshes and BVH leaves,
+// do not enter a parallel region at all
+static void transformAoS(const struct BatchTransform* transform, float* out, size_t outStride, const float* in,
+                         size_t inStride, size_t count)
+{
+    const size_t packed = sizeof(M3DVector3f);
+    bool stream = outStride == packed && inStride == packed && ((uintptr_t)out & 15) == 0 &&
+                  count * packed > M3D_STREAM_BYTES;
+    if (count <= M3D_BATCH_CHUNK)
+    {
+        transformAoSChunk(transform, out, outStride, in, inStride, 0, count, stream);
+    }
+    else
+    {
+        int64_t numChunks = (int64_t)((count + M3D_BATCH_CHUNK - 1) / M3D_BATCH_CHUNK);
+        #pragma omp parallel for schedule(static)
+        for (int64_t c = 0; c < numChunks; ++c)
+        {
+            size_t first = (size_t)c * M3D_BATCH_CHUNK;
+            size_t n = count - first < M3D_BATCH_CHUNK ? count - first : M3D_BATCH_CHUNK;
+            transformAoSChunk(transform, out, outStride, in, inStride, first, n, stream);
+        }
+    }
+#ifdef __SSE2__
+    if (stream)
+        _mm_sfence();
+#endif
+}
+
+static void transformSoA(const struct BatchTransform* transform, float* const out[3], const float* const in[3],
+                         size_t count)
+{
+    bool stream = count * sizeof(float) * 3 > M3D_STREAM_BYTES &&
+                  (((uintptr_t)out[0] | (uintptr_t)out[1] | (uintptr_t)out[2]) & 15) == 0;
+    if (count <= M3D_BATCH_CHUNK)
+    {
+        transformSoAChunk(transform, out, in, 0, count, stream);
+    }
+    else
+    {
+        int64_t numChunks = (int64_t)((count + M3D_BATCH_CHUNK - 1) / M3D_BATCH_CHUNK);
+        #pragma omp parallel for schedule(static)
+        for (int64_t c = 0; c < numChunks; ++c)
+        {
+            size_t first = (size_t)c * M3D_BATCH_CHUNK;
+            size_t end = count - first < M3D_BATCH_CHUNK ? count : first + M3D_BATCH_CHUNK;
+            transformSoAChunk(transform, out, in, first, end, stream);
+        }
+    }
+#ifdef __SSE2__
+    if (stream)
+        _mm_sfence();
+#endif
+}
+
+void m3dTransformPoints3(float* out, size_t outStride, const float* in, size_t inStride, size_t count,
+                         const M3DMatrix44f m)
+{
+    struct BatchTransform transform;
+    getPointTransform(&transform, m);
+    transformAoS(&transform, out, outStride, in, inStride, count);
+}
+
+void m3dTransformNormals3(float* out, size_t outStride, const float* in, size_t inStride, size_t count,
+                          const M3DMatrix44f m, bool normalize)
+{
+    struct BatchTransform transform;
+    getNormalTransform(&transform, m, normalize);
+    transformAoS(&transform, out, outStride, in, inStride, count);
+}
+
+void m3dTransformPoints3SoA(float* const out[3], const float* const in[3], size_t count, const M3DMatrix44f m)
+{
+    struct BatchTransform transform;
+    getPointTransform(&transform, m);
+    transformSoA(&transform, out, in, count);
+}
+
+void m3dTransformNormals3SoA(float* const out[3], const float* const in[3], size_t count, const M3DMatrix44f m,
+                             bool normalize)
+{
+    struct BatchTransform transform;
+    getNormalTransform(&transform, m, normalize);
+    transformSoA(&transform, out, in, count);
+}
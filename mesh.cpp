@@ -0,0 +1,257 @@
+#include "mesh.h"
+#include "math3d.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define WELD_EMPTY 0xFFFFFFFFu
+
+// texture repeats every 50 model units
+#define TEXCOORD_SCALE (1.0f / 50.0f)
+
+// Spatial hash used for welding. Each slot holds the first vertex of a grid
+// cell, vertices of the same cell are chained through next[]. Keys are packed
+// cell coordinates, so far apart cells may share a chain; candidates are
+// always checked against the real positions.
+struct WeldGrid
+{
+    uint32_t mask;
+    uint64_t* keys;
+    uint32_t* heads;
+    uint32_t* next;
+};
+
+static inline uint64_t hashKey(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Cell coordinate of v. Converting a float outside the int32 range is
+// undefined, so the cell is clamped well inside it; cellKey then wraps the
+// coordinate to 21 bits, and cells that alias are told apart by position.
+#define WELD_CELL_LIMIT 1073741824.0f   // 2^30
+static inline int32_t cellCoord(float v, float cellSize)
+{
+    float cell = floorf(v / cellSize);
+    return (int32_t)fminf(fmaxf(cell, -WELD_CELL_LIMIT), WELD_CELL_LIMIT);
+}
+
+static inline uint64_t cellKey(int32_t x, int32_t y, int32_t z)
+{
+    return ((uint64_t)(x & 0x1FFFFF) << 42) | ((uint64_t)(y & 0x1FFFFF) << 21) | (uint64_t)(z & 0x1FFFFF);
+}
+
+static inline uint64_t exactKey(const float p[3])
+{
+    uint32_t bits[3];
+    memcpy(bits, p, sizeof(bits));
+    return ((uint64_t)bits[0] * 73856093u) ^ ((uint64_t)bits[1] << 21) ^ ((uint64_t)bits[2] << 42) ^ bits[2];
+}
+
+static uint32_t* findSlot(WeldGrid* grid, uint64_t key, bool insert)
+{
+    uint32_t slot = (uint32_t)hashKey(key) & grid->mask;
+    while (grid->heads[slot] != WELD_EMPTY)
+    {
+        if (grid->keys[slot] == key)
+            return &grid->heads[slot];
+        slot = (slot + 1) & grid->mask;
+    }
+    if (!insert)
+        return NULL;
+    grid->keys[slot] = key;
+    return &grid->heads[slot];
+}
+
+uint32_t buildIndexedMesh(const struct STLMapping* stl, float weldEpsilon,
+                          MeshNormalMode normalMode, struct IndexedMesh* mesh)
+{
+    memset(mesh, 0, sizeof(*mesh));
+    uint32_t maxVertices = stl->numTriangles * 3;
+    if (maxVertices == 0)
+        return 0;
+
+    WeldGrid grid;
+    uint32_t tableSize = 1;
+    while (tableSize < maxVertices * 2) tableSize <<= 1;
+    grid.mask = tableSize - 1;
+    grid.keys = (uint64_t*)malloc(tableSize * sizeof(uint64_t));
+    grid.heads = (uint32_t*)malloc(tableSize * sizeof(uint32_t));
+    grid.next = (uint32_t*)malloc(maxVertices * sizeof(uint32_t));
+    mesh->vertices = (struct MeshVertex*)calloc(maxVertices, sizeof(struct MeshVertex));
+    uint32_t* indices = (uint32_t*)malloc(maxVertices * sizeof(uint32_t));
+    if (!grid.keys || !grid.heads || !grid.next || !mesh->vertices || !indices)
+    {
+        perror("Failed to allocate memory");
+        free(grid.keys);
+        free(grid.heads);
+        free(grid.next);
+        free(indices);
+        freeIndexedMesh(mesh);
+        return 0;
+    }
+    memset(grid.heads, 0xFF, tableSize * sizeof(uint32_t));
+
+    // cells twice the epsilon wide: the neighbourhood of a point spans at
+    // most two cells per axis
+    float cellSize = 2.0f * weldEpsilon;
+    uint32_t numVertices = 0;
+    uint32_t numIndices = 0;
+
+    for (uint32_t t = 0; t < stl->numTriangles; ++t)
+    {
+        M3DVector3f corners[3];
+        for (int v = 0; v < 3; ++v)
+        {
+            memcpy(corners[v], stlFacetVertex(stl, t, v), sizeof(M3DVector3f));
+            // -0 and +0 must hash the same
+            corners[v][0] += 0.0f;
+            corners[v][1] += 0.0f;
+            corners[v][2] += 0.0f;
+        }
+
+        // area weighted, normalized below
+        M3DVector3f facetNormal, unitNormal;
+        m3dFindNormal(facetNormal, corners[0], corners[1], corners[2]);
+        m3dCopyVector3(unitNormal, facetNormal);
+        if (m3dGetVectorLengthSquared(unitNormal) > 0.0f)
+            m3dNormalizeVector(unitNormal);
+
+        uint32_t tri[3];
+        for (int v = 0; v < 3; ++v)
+        {
+            const float* p = corners[v];
+            uint32_t found = WELD_EMPTY;
+
+            if (weldEpsilon > 0.0f)
+            {
+                int32_t lo[3], hi[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    lo[k] = cellCoord(p[k] - weldEpsilon, cellSize);
+                    hi[k] = cellCoord(p[k] + weldEpsilon, cellSize);
+                }
+                for (int32_t x = lo[0]; x <= hi[0] && found == WELD_EMPTY; ++x)
+                for (int32_t y = lo[1]; y <= hi[1] && found == WELD_EMPTY; ++y)
+                for (int32_t z = lo[2]; z <= hi[2] && found == WELD_EMPTY; ++z)
+                {
+                    uint32_t* head = findSlot(&grid, cellKey(x, y, z), false);
+                    for (uint32_t c = head ? *head : WELD_EMPTY; c != WELD_EMPTY; c = grid.next[c])
+                    {
+                        const float* q = mesh->vertices[c].position;
+                        if (fabsf(q[0] - p[0]) > weldEpsilon || fabsf(q[1] - p[1]) > weldEpsilon ||
+                            fabsf(q[2] - p[2]) > weldEpsilon)
+                            continue;
+                        if (normalMode == FacetedNormals &&
+                            m3dDotProduct(mesh->vertices[c].normal, unitNormal) < 0.9999f)
+                            continue;
+                        found = c;
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                uint32_t* head = findSlot(&grid, exactKey(p), false);
+                for (uint32_t c = head ? *head : WELD_EMPTY; c != WELD_EMPTY; c = grid.next[c])
+                {
+                    const float* q = mesh->vertices[c].position;
+                    if (q[0] != p[0] || q[1] != p[1] || q[2] != p[2])
+                        continue;
+                    if (normalMode == FacetedNormals &&
+                        m3dDotProduct(mesh->vertices[c].normal, unitNormal) < 0.9999f)
+                        continue;
+                    found = c;
+                    break;
+                }
+            }
+
+            if (found == WELD_EMPTY)
+            {
+                found = numVertices++;
+                memcpy(mesh->vertices[found].position, p, sizeof(M3DVector3f));
+                if (normalMode == FacetedNormals)
+                    memcpy(mesh->vertices[found].normal, unitNormal, sizeof(M3DVector3f));
+
+                uint64_t key = weldEpsilon > 0.0f
+                    ? cellKey(cellCoord(p[0], cellSize), cellCoord(p[1], cellSize), cellCoord(p[2], cellSize))
+                    : exactKey(p);
+                uint32_t* head = findSlot(&grid, key, true);
+                grid.next[found] = *head;
+                *head = found;
+            }
+            tri[v] = found;
+        }
+
+        // collapsed by welding
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2])
+            continue;
+
+        if (normalMode == SmoothNormals)
+        {
+            for (int v = 0; v < 3; ++v)
+                m3dAddVectors3(mesh->vertices[tri[v]].normal, mesh->vertices[tri[v]].normal, facetNormal);
+        }
+        indices[numIndices++] = tri[0];
+        indices[numIndices++] = tri[1];
+        indices[numIndices++] = tri[2];
+    }
+
+    free(grid.keys);
+    free(grid.heads);
+    free(grid.next);
+
+    for (uint32_t i = 0; i < numVertices; ++i)
+    {
+        struct MeshVertex* v = &mesh->vertices[i];
+        if (normalMode == SmoothNormals && m3dGetVectorLengthSquared(v->normal) > 0.0f)
+            m3dNormalizeVector(v->normal);
+
+        // project onto the plane most facing the normal
+        float ax = fabsf(v->normal[0]), ay = fabsf(v->normal[1]), az = fabsf(v->normal[2]);
+        int u = 0, w = 1;
+        if (ax >= ay && ax >= az) { u = 2; w = 1; }
+        else if (ay >= az)        { u = 0; w = 2; }
+        v->texCoord[0] = v->position[u] * TEXCOORD_SCALE;
+        v->texCoord[1] = v->position[w] * TEXCOORD_SCALE;
+    }
+
+    mesh->numVertices = numVertices;
+    mesh->numIndices = numIndices;
+    mesh->vertices = (struct MeshVertex*)realloc(mesh->vertices, numVertices * sizeof(struct MeshVertex));
+
+    if (numVertices <= 0x10000)
+    {
+        uint16_t* shortIndices = (uint16_t*)malloc(numIndices * sizeof(uint16_t));
+        if (!shortIndices)
+        {
+            perror("Failed to allocate memory");
+            free(indices);
+            freeIndexedMesh(mesh);
+            return 0;
+        }
+        for (uint32_t i = 0; i < numIndices; ++i)
+            shortIndices[i] = (uint16_t)indices[i];
+        free(indices);
+        mesh->indexSize = 2;
+        mesh->indices = shortIndices;
+    }
+    else
+    {
+        mesh->indexSize = 4;
+        mesh->indices = realloc(indices, numIndices * sizeof(uint32_t));
+    }
+    return numVertices;
+}
+
+void freeIndexedMesh(struct IndexedMesh* mesh)
+{
+    free(mesh->vertices);
+    free(mesh->indices);
+    memset(mesh, 0, sizeof(*mesh));
+}
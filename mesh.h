@@ -0,0 +1,47 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+#include "readstl.h"
+
+enum MeshNormalMode
+{
+    FacetedNormals,     // one normal per facet, vertices only shared inside flat regions
+    SmoothNormals       // area-weighted average over all facets sharing a position
+};
+
+// Interleaved vertex used by every draw path, 32 bytes
+struct MeshVertex
+{
+    float position[3];
+    float normal[3];
+    float texCoord[2];
+};
+
+// Welded, indexed triangle mesh built from an STL triangle soup.
+// indexSize is 2 when every index fits in 16 bits, 4 otherwise.
+struct IndexedMesh
+{
+    uint32_t numVertices;
+    struct MeshVertex* vertices;
+    uint32_t numIndices;
+    uint32_t indexSize;
+    void* indices;          // uint16_t or uint32_t, 3 per triangle
+};
+
+// Weld vertices closer than weldEpsilon (0 welds exact duplicates only) with
+// a spatial hash and build the vertex and index buffers. Triangles that
+// collapse after welding are dropped. STL has no texture coordinates, they
+// are box projected along the dominant axis of each vertex normal.
+// Returns the number of vertices, 0 on failure.
+uint32_t buildIndexedMesh(const struct STLMapping* stl, float weldEpsilon,
+                          MeshNormalMode normalMode, struct IndexedMesh* mesh);
+void freeIndexedMesh(struct IndexedMesh* mesh);
+
+inline uint32_t getMeshIndex(const struct IndexedMesh* mesh, uint32_t i)
+{
+    return mesh->indexSize == 2 ? ((const uint16_t*)mesh->indices)[i]
+                                : ((const uint32_t*)mesh->indices)[i];
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include "reachmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BRICK_WORDS REACHMAP_BRICK_SIZE     // one uint64 per z slice
+
+// FNV-1a
+static uint32_t hashBytes(uint32_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t getArmHash(float clawLength, float voxelSize)
+{
+    uint32_t hash = 2166136261u;
+    hash = hashBytes(hash, linkOrigins, sizeof(linkOrigins));
+    hash = hashBytes(hash, linkRotateAxis, sizeof(linkRotateAxis));
+    hash = hashBytes(hash, &clawLength, sizeof(clawLength));
+    hash = hashBytes(hash, &voxelSize, sizeof(voxelSize));
+    return hash;
+}
+
+static size_t getBitsOffset(size_t totalBricks)
+{
+    return (sizeof(struct ReachabilityMapHeader) + totalBricks * sizeof(uint32_t) + 7) & ~(size_t)7;
+}
+
+int saveReachabilityMap(const struct WorkspaceSampler* sampler, const char* filename)
+{
+    int32_t* voxels = (int32_t*)malloc((size_t)sampler->numVoxels * 3 * sizeof(int32_t));
+    if (!voxels)
+    {
+        perror("Failed to allocate memory");
+        return 0;
+    }
+    uint32_t numVoxels = getWorkspaceVoxels(sampler, voxels);
+
+    struct ReachabilityMapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "RMAP", 4);
+    header.version = REACHMAP_VERSION;
+    header.armHash = getArmHash(sampler->clawLength, sampler->voxelSize);
+    header.voxelSize = sampler->voxelSize;
+
+    int32_t lo[3] = { 0, 0, 0 }, hi[3] = { -1, -1, -1 };
+    for (uint32_t i = 0; i < numVoxels; ++i)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            int32_t v = voxels[i * 3 + k];
+            if (i == 0 || v < lo[k]) lo[k] = v;
+            if (i == 0 || v > hi[k]) hi[k] = v;
+        }
+    }
+    size_t totalBricks = 1;
+    for (int k = 0; k < 3; ++k)
+    {
+        header.origin[k] = lo[k];
+        header.bricks[k] = (uint32_t)(hi[k] - lo[k] + REACHMAP_BRICK_SIZE) / REACHMAP_BRICK_SIZE;
+        totalBricks *= header.bricks[k];
+    }
+
+    // dense bricks first, then empty and full ones are dropped
+    uint64_t* dense = (uint64_t*)calloc(totalBricks * BRICK_WORDS, sizeof(uint64_t));
+    uint32_t* brickIndex = (uint32_t*)malloc(totalBricks * sizeof(uint32_t));
+    if (!dense || !brickIndex)
+    {
+        perror("Failed to allocate memory");
+        free(voxels);
+        free(dense);
+        free(brickIndex);
+        return 0;
+    }
+    for (uint32_t i = 0; i < numVoxels; ++i)
+    {
+        int32_t v[3];
+        for (int k = 0; k < 3; ++k)
+            v[k] = voxels[i * 3 + k] - lo[k];
+        size_t brick = ((size_t)(v[2] / REACHMAP_BRICK_SIZE) * header.bricks[1] + v[1] / REACHMAP_BRICK_SIZE) *
+                       header.bricks[0] + v[0] / REACHMAP_BRICK_SIZE;
+        dense[brick * BRICK_WORDS + v[2] % REACHMAP_BRICK_SIZE] |=
+            1ULL << ((v[1] % REACHMAP_BRICK_SIZE) * REACHMAP_BRICK_SIZE + v[0] % REACHMAP_BRICK_SIZE);
+    }
+    free(voxels);
+
+    uint32_t numStored = 0;
+    for (size_t b = 0; b < totalBricks; ++b)
+    {
+        bool empty = true, full = true;
+        for (int w = 0; w < BRICK_WORDS; ++w)
+        {
+            empty = empty && dense[b * BRICK_WORDS + w] == 0;
+            full = full && dense[b * BRICK_WORDS + w] == ~0ULL;
+        }
+        if (empty)
+            brickIndex[b] = REACHMAP_EMPTY;
+        else if (full)
+            brickIndex[b] = REACHMAP_FULL;
+        else
+        {
+            // compact in place, stored bricks never overtake the scan
+            memmove(&dense[(size_t)numStored * BRICK_WORDS], &dense[b * BRICK_WORDS], BRICK_WORDS * sizeof(uint64_t));
+            brickIndex[b] = numStored++;
+        }
+    }
+    header.numStoredBricks = numStored;
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        perror("Failed to open file");
+        free(dense);
+        free(brickIndex);
+        return 0;
+    }
+    static const unsigned char padding[8] = { 0 };
+    size_t indexEnd = sizeof(header) + totalBricks * sizeof(uint32_t);
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(brickIndex, sizeof(uint32_t), totalBricks, fp) == totalBricks &&
+              fwrite(padding, 1, getBitsOffset(totalBricks) - indexEnd, fp) == getBitsOffset(totalBricks) - indexEnd &&
+              fwrite(dense, BRICK_WORDS * sizeof(uint64_t), numStored, fp) == numStored;
+    ok = (fclose(fp) == 0) && ok;
+    free(dense);
+    free(brickIndex);
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to write %s\n", filename);
+        return 0;
+    }
+    printf("Saved %s: %u voxels, %zu bricks, %u stored\n", filename, numVoxels, totalBricks, numStored);
+    return 1;
+}
+
+int mapReachabilityMap(const char* filename, uint32_t expectedArmHash, struct ReachabilityMap* map)
+{
+    memset(map, 0, sizeof(*map));
+    if (!mapFile(filename, &map->file))
+        return 0;
+
+    const struct ReachabilityMapHeader* header = (const struct ReachabilityMapHeader*)map->file.data;
+    const char* problem = NULL;
+    size_t totalBricks = 0;
+    if (map->file.size < sizeof(*header) || memcmp(header->magic, "RMAP", 4) != 0 ||
+        header->version != REACHMAP_VERSION)
+        problem = "not a reachability map";
+    else if (header->armHash != expectedArmHash)
+        problem = "built for a different arm";
+    else
+    {
+        // the index alone must fit in the file, which also keeps the product
+        // and the voxel counts in isReachable from overflowing
+        size_t maxBricks = map->file.size / sizeof(uint32_t);
+        totalBricks = 1;
+        for (int k = 0; k < 3 && !problem; ++k)
+        {
+            if (header->bricks[k] > INT32_MAX / REACHMAP_BRICK_SIZE ||
+                (header->bricks[k] && totalBricks > maxBricks / header->bricks[k]))
+                problem = "brick grid does not fit in the file";
+            else
+                totalBricks *= header->bricks[k];
+        }
+        if (!problem &&
+            map->file.size != getBitsOffset(totalBricks) + (size_t)header->numStoredBricks * BRICK_WORDS * sizeof(uint64_t))
+            problem = "size does not match the header";
+    }
+    if (!problem)
+    {
+        // every stored brick referenced by isReachable must be in the file
+        const uint32_t* brickIndex = (const uint32_t*)(map->file.data + sizeof(*header));
+        for (size_t i = 0; i < totalBricks; ++i)
+        {
+            uint32_t index = brickIndex[i];
+            if (index != REACHMAP_EMPTY && index != REACHMAP_FULL && index >= header->numStoredBricks)
+            {
+                problem = "brick index out of range";
+                break;
+            }
+        }
+    }
+    if (problem)
+    {
+        fprintf(stderr, "%s: %s\n", filename, problem);
+        unmapReachabilityMap(map);
+        return 0;
+    }
+
+    map->header = header;
+    map->brickIndex = (const uint32_t*)(map->file.data + sizeof(*header));
+    map->brickBits = (const uint64_t*)(map->file.data + getBitsOffset(totalBricks));
+    return 1;
+}
+
+void unmapReachabilityMap(struct ReachabilityMap* map)
+{
+    unmapFile(&map->file);
+    memset(map, 0, sizeof(*map));
+}
+
+void queryReachabilityBatch(const struct ReachabilityMap* map, const float* const positions[3], size_t count,
+                            uint8_t* reachable)
+{
+    #pragma omp parallel for schedule(static) if (count > 65536)
+    for (int64_t i = 0; i < (int64_t)count; ++i)
+    {
+        float p[3] = { positions[0][i], positions[1][i], positions[2][i] };
+        reachable[i] = (uint8_t)isReachable(map, p);
+    }
+}
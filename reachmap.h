@@ -0,0 +1,80 @@
+#ifndef REACHMAP_H
+#define REACHMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include "mapfile.h"
+#include "workspace.h"
+
+// Reachability volume file: the voxels of a finished WorkspaceSampler,
+// stored as 8x8x8 bricks of bits. Bricks that are all empty or all full
+// take no space beyond their index entry. The file is memory-mapped and
+// queried in place.
+#define REACHMAP_BRICK_SIZE 8
+#define REACHMAP_EMPTY 0xFFFFFFFFu
+#define REACHMAP_FULL 0xFFFFFFFEu
+#define REACHMAP_VERSION 1
+
+struct ReachabilityMapHeader
+{
+    char magic[4];                  // "RMAP"
+    uint32_t version;
+    uint32_t armHash;               // getArmHash of the arm it was built for
+    float voxelSize;
+    int32_t origin[3];              // first voxel of brick 0, in voxels
+    uint32_t bricks[3];             // grid size in bricks
+    uint32_t numStoredBricks;
+    uint32_t reserved;
+};
+// followed by bricks[0] * bricks[1] * bricks[2] uint32 brick indices
+// (x fastest), padded to 8 bytes, then numStoredBricks bricks of 8 uint64
+// (one per z slice, bit y * 8 + x)
+
+struct ReachabilityMap
+{
+    struct MappedFile file;
+    const struct ReachabilityMapHeader* header;
+    const uint32_t* brickIndex;
+    const uint64_t* brickBits;
+};
+
+// Identifies linkOrigins, linkRotateAxis, the claw length and the voxel size
+uint32_t getArmHash(float clawLength, float voxelSize);
+
+// Returns 1 on success
+int saveReachabilityMap(const struct WorkspaceSampler* sampler, const char* filename);
+// Returns 1 on success, 0 if the file is missing, malformed or was built
+// for another arm (expectedArmHash)
+int mapReachabilityMap(const char* filename, uint32_t expectedArmHash, struct ReachabilityMap* map);
+void unmapReachabilityMap(struct ReachabilityMap* map);
+
+// O(1): one index lookup and at most one bit test
+static inline int isReachable(const struct ReachabilityMap* map, const float position[3])
+{
+    const struct ReachabilityMapHeader* header = map->header;
+    int32_t brick[3], bit[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        // divided like the sampler that wrote the map, so points on a cell
+        // boundary land in the same voxel
+        int32_t voxel = (int32_t)floorf(position[k] / header->voxelSize) - header->origin[k];
+        if (voxel < 0 || voxel >= (int32_t)(header->bricks[k] * REACHMAP_BRICK_SIZE))
+            return 0;
+        brick[k] = voxel / REACHMAP_BRICK_SIZE;
+        bit[k] = voxel % REACHMAP_BRICK_SIZE;
+    }
+    uint32_t index = map->brickIndex[(brick[2] * header->bricks[1] + brick[1]) * header->bricks[0] + brick[0]];
+    if (index == REACHMAP_EMPTY)
+        return 0;
+    if (index == REACHMAP_FULL)
+        return 1;
+    uint64_t word = map->brickBits[(size_t)index * REACHMAP_BRICK_SIZE + bit[2]];
+    return (int)((word >> (bit[1] * REACHMAP_BRICK_SIZE + bit[0])) & 1);
+}
+
+// positions is structure of arrays; reachable[i] is set to 0 or 1
+void queryReachabilityBatch(const struct ReachabilityMap* map, const float* const positions[3], size_t count,
+                            uint8_t* reachable);
+
+#endif
@@ -4,37 +4,122 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <float.h>
+#include <locale.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-uint32_t readBinSTL(const char* filename, float** triangles, float** normals)
+uint32_t mapBinSTL(const char* filename, struct STLMapping* mapping)
 {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        perror("Failed to open file");
+    memset(mapping, 0, sizeof(*mapping));
+    if (!mapFile(filename, &mapping->file))
+        return 0;
+
+    if (mapping->file.size < STL_HEADER_SIZE) {
+        fprintf(stderr, "%s is too small to be a binary STL\n", filename);
+        unmapFile(&mapping->file);
         return 0;
     }
-    // Skip the 80-byte header
-    fseek(file, 80, SEEK_SET);
-    
+
     uint32_t numTriangles;
-    fread(&numTriangles, sizeof(uint32_t), 1, file);
+    memcpy(&numTriangles, mapping->file.data + 80, sizeof(uint32_t));
+    // trailing bytes are tolerated, missing facets are not
+    uint64_t expectedSize = STL_HEADER_SIZE + (uint64_t)numTriangles * STL_FACET_STRIDE;
+    if (numTriangles == 0 || expectedSize > mapping->file.size) {
+        fprintf(stderr, "%s: header claims %u triangles but file has %zu bytes\n",
+                filename, numTriangles, mapping->file.size);
+        unmapFile(&mapping->file);
+        return 0;
+    }
+
+    mapping->facets = mapping->file.data + STL_HEADER_SIZE;
+    mapping->numTriangles = numTriangles;
+    return numTriangles;
+}
+
+void unmapBinSTL(struct STLMapping* mapping)
+{
+    unmapFile(&mapping->file);
+    free(mapping->packed);
+    mapping->packed = NULL;
+    mapping->facets = NULL;
+    mapping->numTriangles = 0;
+}
+
+uint32_t mapSTL(const char* filename, struct STLMapping* mapping)
+{
+    memset(mapping, 0, sizeof(*mapping));
+    if (!mapFile(filename, &mapping->file))
+        return 0;
+
+    // A binary header may start with "solid" too, so the size check decides
+    int ascii = 1;
+    if (mapping->file.size >= STL_HEADER_SIZE) {
+        uint32_t numTriangles;
+        memcpy(&numTriangles, mapping->file.data + 80, sizeof(uint32_t));
+        uint64_t expectedSize = STL_HEADER_SIZE + (uint64_t)numTriangles * STL_FACET_STRIDE;
+        ascii = numTriangles == 0 || expectedSize > mapping->file.size;
+    }
+    if (ascii && (mapping->file.size < 5 || memcmp(mapping->file.data, "solid", 5) != 0))
+    {
+        fprintf(stderr, "%s is neither a binary nor an ASCII STL\n", filename);
+        unmapFile(&mapping->file);
+        return 0;
+    }
+    unmapFile(&mapping->file);
+    if (!ascii)
+        return mapBinSTL(filename, mapping);
+
+    struct Triangle* triangles = NULL;
+    uint32_t numTriangles = readAsciiSTLParallel(filename, &triangles);
+    if (!numTriangles)
+        return 0;
+
+    mapping->packed = (unsigned char*)malloc((size_t)numTriangles * STL_FACET_STRIDE);
+    if (!mapping->packed) {
+        perror("Failed to allocate memory");
+        free(triangles);
+        return 0;
+    }
+    for (uint32_t i = 0; i < numTriangles; i++)
+    {
+        unsigned char* record = mapping->packed + (size_t)i * STL_FACET_STRIDE;
+        memcpy(record, triangles[i].normal, 12);
+        memcpy(record + 12, triangles[i].vertex1, 12);
+        memcpy(record + 24, triangles[i].vertex2, 12);
+        memcpy(record + 36, triangles[i].vertex3, 12);
+        memcpy(record + 48, &triangles[i].attrByteCount, 2);
+    }
+    free(triangles);
+    mapping->facets = mapping->packed;
+    mapping->numTriangles = numTriangles;
+    return numTriangles;
+}
+
+uint32_t readBinSTL(const char* filename, float** triangles, float** normals)
+{
+    struct STLMapping mapping;
+    uint32_t numTriangles = mapBinSTL(filename, &mapping);
+    if (!numTriangles)
+        return 0;
+
     *triangles = (float*)malloc(numTriangles * sizeof(float) * 9);
     *normals = (float*)malloc(numTriangles * sizeof(float) * 3);
     if (!*triangles || !*normals) {
         perror("Failed to allocate memory");
-        fclose(file);
+        free(*triangles);
+        free(*normals);
+        unmapBinSTL(&mapping);
         return 0;
     }
 
-    char buffer[50];
     for (uint32_t i = 0; i < numTriangles; i++)
     {
-        fread(buffer, 50, 1, file);
-        float* tri = &((*triangles)[i * 9]);
-        float* norm = &((*normals)[i * 3]);
-        memcpy(norm, buffer, 12);
-        memcpy(tri, buffer + 12, 36);
+        memcpy(&((*normals)[i * 3]), stlFacetNormal(&mapping, i), 12);
+        memcpy(&((*triangles)[i * 9]), stlFacetVertex(&mapping, i, 0), 36);
     }
-    fclose(file);
+    unmapBinSTL(&mapping);
     return numTriangles;
 }
 
@@ -194,4 +279,358 @@ uint32_t readAsciiSTL(const char* filename, struct Triangle** triangles)
     }
     fclose(file);
     return numTriangles;
-}
\ No newline at end of file
+}
+
+// Cursor over an in-memory (not NUL-terminated) span of an ASCII STL file.
+// The helpers below reproduce, on memory, exactly what the fscanf/fgets
+// calls in readAsciiSTL do on a FILE, so both parsers accept and reject the
+// same input and produce the same floats.
+struct STLCursor
+{
+    const char* p;
+    const char* end;
+};
+
+static inline int isSTLSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// fscanf(" %31s")
+static int scanToken(struct STLCursor* cur, char token[32])
+{
+    while (cur->p < cur->end && isSTLSpace(*cur->p)) cur->p++;
+    if (cur->p == cur->end) return 0;
+    int n = 0;
+    while (n < 31 && cur->p < cur->end && !isSTLSpace(*cur->p))
+        token[n++] = *cur->p++;
+    token[n] = '\0';
+    return 1;
+}
+
+// fgets(line, 256) where only the position after the call matters
+static int scanLine(struct STLCursor* cur)
+{
+    if (cur->p == cur->end) return 0;
+    const char* limit = cur->end - cur->p > 255 ? cur->p + 255 : cur->end;
+    const char* nl = (const char*)memchr(cur->p, '\n', limit - cur->p);
+    cur->p = nl ? nl + 1 : limit;
+    return 1;
+}
+
+// Anything the fast path can't prove it rounds correctly goes through strtof.
+// The token is copied to the stack so no allocation happens and the mapping
+// doesn't need a terminator. The decimal point is swapped for the one of the
+// current locale, which keeps the result locale independent.
+static int scanFloatSlow(struct STLCursor* cur, float* value)
+{
+    char buffer[64];
+    int n = 0;
+    while (n < (int)sizeof(buffer) - 1 && cur->p + n < cur->end && !isSTLSpace(cur->p[n]))
+    {
+        buffer[n] = cur->p[n];
+        if (buffer[n] == '.') buffer[n] = localeconv()->decimal_point[0];
+        n++;
+    }
+    buffer[n] = '\0';
+    char* stop;
+    *value = strtof(buffer, &stop);
+    if (stop == buffer) return 0;
+    cur->p += stop - buffer;
+    return 1;
+}
+
+// fscanf(" %f"), locale independent and allocation free.
+// Decimal input with at most 19 significant digits and a power of ten that
+// is exact in a double (|e| <= 22) is converted with one correctly rounded
+// double operation (Clinger's fast path). The double to float rounding is
+// then exact too unless the double sits on a float halfway point, which is
+// left to strtof together with hex, inf, nan and out of range values.
+static int scanFloat(struct STLCursor* cur, float* value)
+{
+    static const double powersOf10[23] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    while (cur->p < cur->end && isSTLSpace(*cur->p)) cur->p++;
+    const char* p = cur->p;
+    const char* end = cur->end;
+
+    int negative = 0;
+    if (p < end && (*p == '+' || *p == '-')) negative = (*p++ == '-');
+    if (p < end && (*p == 'i' || *p == 'I' || *p == 'n' || *p == 'N'))
+        return scanFloatSlow(cur, value);
+    if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        return scanFloatSlow(cur, value);
+
+    uint64_t mantissa = 0;
+    int digits = 0;         // significant digits in mantissa
+    int anyDigits = 0;
+    int exponent10 = 0;
+    int truncated = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        anyDigits = 1;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa) digits++;
+        } else {
+            truncated = 1;
+            exponent10++;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            anyDigits = 1;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa) digits++;
+                exponent10--;
+            } else {
+                truncated = 1;
+            }
+        }
+    }
+    if (!anyDigits) return 0;
+
+    // glibc consumes a dangling 'e' or 'e+' and keeps the mantissa
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        int expNegative = 0;
+        if (p < end && (*p == '+' || *p == '-')) expNegative = (*p++ == '-');
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+            if (e < 100000) e = e * 10 + (*p - '0');
+        exponent10 += expNegative ? -e : e;
+    }
+
+    if (mantissa == 0) {
+        *value = negative ? -0.0f : 0.0f;
+        cur->p = p;
+        return 1;
+    }
+    if (truncated || mantissa > ((uint64_t)1 << 53) || exponent10 < -22 || exponent10 > 22)
+        return scanFloatSlow(cur, value);
+
+    double d = (double)mantissa;
+    d = exponent10 < 0 ? d / powersOf10[-exponent10] : d * powersOf10[exponent10];
+    if (d < FLT_MIN || d > FLT_MAX)
+        return scanFloatSlow(cur, value);
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    if ((bits & 0x1FFFFFFF) == 0x10000000)
+        return scanFloatSlow(cur, value);
+
+    *value = negative ? -(float)d : (float)d;
+    cur->p = p;
+    return 1;
+}
+
+// Returns the start of the first line at or after p whose first token is
+// 'facet', or end. p must be the start of a line.
+static const char* findFacetLine(const char* p, const char* end)
+{
+    while (p < end)
+    {
+        const char* q = p;
+        while (q < end && (*q == ' ' || *q == '\t' || *q == '\r' || *q == '\v' || *q == '\f')) q++;
+        if (end - q > 5 && memcmp(q, "facet", 5) == 0 && isSTLSpace(q[5]))
+            return p;
+        const char* nl = (const char*)memchr(q, '\n', end - q);
+        if (!nl) break;
+        p = nl + 1;
+    }
+    return end;
+}
+
+// Same grammar as readAsciiSTL. Returns 1 on success, 0 on a parse error
+// (message left in error), -1 if the chunk holds more facets than capacity.
+static int parseAsciiChunk(struct STLCursor cur, struct Triangle* triangles, uint32_t capacity,
+                           uint32_t* count, char error[96])
+{
+    uint32_t numTriangles = 0;
+    char token[32];
+    while (scanToken(&cur, token))
+    {
+        if (strcmp(token, "facet") != 0) {
+            // 'endsolid' or unknown token: skip the rest of the line
+            if (!scanLine(&cur)) break;
+            continue;
+        }
+        if (numTriangles == capacity) return -1;
+        struct Triangle* tri = &triangles[numTriangles];
+        memset(tri, 0, sizeof(*tri));
+
+        if (!scanToken(&cur, token) || strcmp(token, "normal") != 0) {
+            snprintf(error, 96, "Expected 'normal' after 'facet'");
+            return 0;
+        }
+        if (!scanFloat(&cur, &tri->normal[0]) || !scanFloat(&cur, &tri->normal[1]) ||
+            !scanFloat(&cur, &tri->normal[2])) {
+            snprintf(error, 96, "Failed to read facet normal floats");
+            return 0;
+        }
+        if (!scanLine(&cur)) {
+            snprintf(error, 96, "Unexpected EOF after facet normal");
+            return 0;
+        }
+        if (!scanToken(&cur, token) || strcmp(token, "outer") != 0) {
+            snprintf(error, 96, "Expected 'outer loop'");
+            return 0;
+        }
+        if (!scanToken(&cur, token) || strcmp(token, "loop") != 0) {
+            snprintf(error, 96, "Expected 'loop' after 'outer'");
+            return 0;
+        }
+        float* vertices[3] = { tri->vertex1, tri->vertex2, tri->vertex3 };
+        for (int v = 0; v < 3; v++)
+        {
+            if (!scanToken(&cur, token)) {
+                snprintf(error, 96, "Unexpected EOF when reading vertex");
+                return 0;
+            }
+            if (strcmp(token, "vertex") != 0) {
+                snprintf(error, 96, "Expected 'vertex' token, got '%s'", token);
+                return 0;
+            }
+            if (!scanFloat(&cur, &vertices[v][0]) || !scanFloat(&cur, &vertices[v][1]) ||
+                !scanFloat(&cur, &vertices[v][2])) {
+                snprintf(error, 96, "Failed to read vertex floats");
+                return 0;
+            }
+            if (!scanLine(&cur)) {
+                snprintf(error, 96, "Unexpected EOF after vertex");
+                return 0;
+            }
+        }
+        if (!scanToken(&cur, token) || strcmp(token, "endloop") != 0) {
+            snprintf(error, 96, "Expected 'endloop'");
+            return 0;
+        }
+        if (!scanToken(&cur, token) || strcmp(token, "endfacet") != 0) {
+            snprintf(error, 96, "Expected 'endfacet'");
+            return 0;
+        }
+        numTriangles++;
+    }
+    *count = numTriangles;
+    return 1;
+}
+
+uint32_t readAsciiSTLParallel(const char* filename, struct Triangle** triangles)
+{
+    struct MappedFile file;
+    if (!mapFile(filename, &file))
+        return 0;
+
+    const char* begin = (const char*)file.data;
+    const char* end = begin + file.size;
+
+    // header line (solid ...)
+    struct STLCursor header = { begin, end };
+    scanLine(&header);
+    begin = header.p;
+
+    // Split at lines starting with 'facet'. Every facet block in a valid file
+    // starts such a line, and a split inside a block would be a parse error
+    // for readAsciiSTL too, so each chunk parses independently.
+#ifdef _OPENMP
+    int numChunks = omp_get_max_threads() * 4;
+#else
+    int numChunks = 1;
+#endif
+    if ((size_t)(end - begin) < (size_t)numChunks * 65536)
+        numChunks = (int)((end - begin) / 65536) + 1;
+
+    const char** chunkStart = (const char**)malloc((numChunks + 1) * sizeof(const char*));
+    uint32_t* chunkCapacity = (uint32_t*)malloc(numChunks * sizeof(uint32_t));
+    uint32_t* chunkCount = (uint32_t*)malloc(numChunks * sizeof(uint32_t));
+    int* chunkStatus = (int*)malloc(numChunks * sizeof(int));
+    char (*chunkError)[96] = (char (*)[96])malloc(numChunks * sizeof(*chunkError));
+    if (!chunkStart || !chunkCapacity || !chunkCount || !chunkStatus || !chunkError) {
+        perror("Failed to allocate memory");
+        free(chunkStart); free(chunkCapacity); free(chunkCount); free(chunkStatus); free(chunkError);
+        unmapFile(&file);
+        return 0;
+    }
+
+    chunkStart[0] = begin;
+    chunkStart[numChunks] = end;
+    for (int c = 1; c < numChunks; c++)
+    {
+        const char* p = begin + (end - begin) / numChunks * c;
+        if (p < chunkStart[c - 1]) p = chunkStart[c - 1];
+        const char* nl = (const char*)memchr(p, '\n', end - p);
+        chunkStart[c] = nl ? findFacetLine(nl + 1, end) : end;
+    }
+
+    // Count facet lines per chunk to size the output up front
+    int c;
+    #pragma omp parallel for schedule(dynamic)
+    for (c = 0; c < numChunks; c++)
+    {
+        uint32_t n = 0;
+        const char* p = findFacetLine(chunkStart[c], chunkStart[c + 1]);
+        while (p < chunkStart[c + 1])
+        {
+            n++;
+            const char* nl = (const char*)memchr(p, '\n', chunkStart[c + 1] - p);
+            p = nl ? findFacetLine(nl + 1, chunkStart[c + 1]) : chunkStart[c + 1];
+        }
+        chunkCapacity[c] = n;
+    }
+    uint32_t total = 0;
+    for (c = 0; c < numChunks; c++) total += chunkCapacity[c];
+
+    *triangles = total ? (struct Triangle*)malloc(total * sizeof(struct Triangle)) : NULL;
+    if (total && !*triangles) {
+        perror("Failed to allocate memory");
+        total = 0;
+    }
+
+    uint32_t numTriangles = 0;
+    int fallback = (total == 0);
+    if (!fallback)
+    {
+        #pragma omp parallel for schedule(dynamic)
+        for (c = 0; c < numChunks; c++)
+        {
+            uint32_t offset = 0;
+            for (int k = 0; k < c; k++) offset += chunkCapacity[k];
+            struct STLCursor cur = { chunkStart[c], chunkStart[c + 1] };
+            chunkStatus[c] = parseAsciiChunk(cur, *triangles + offset, chunkCapacity[c],
+                                             &chunkCount[c], chunkError[c]);
+        }
+
+        for (c = 0; c < numChunks; c++)
+        {
+            if (chunkStatus[c] == 0) {
+                fprintf(stderr, "%s\n", chunkError[c]);
+                free(*triangles);
+                *triangles = NULL;
+                numTriangles = 0;
+                break;
+            }
+            // several facets on one line: not worth splitting
+            if (chunkStatus[c] < 0 || chunkCount[c] != chunkCapacity[c]) {
+                fallback = 1;
+                break;
+            }
+            numTriangles += chunkCount[c];
+        }
+    }
+
+    free(chunkStart); free(chunkCapacity); free(chunkCount); free(chunkStatus); free(chunkError);
+    unmapFile(&file);
+
+    if (fallback) {
+        free(*triangles);
+        return readAsciiSTL(filename, triangles);
+    }
+    return numTriangles;
+}
@@ -1,4 +1,8 @@
+#ifndef READSTL_H
+#define READSTL_H
+
 #include <stdint.h>
+#include "mapfile.h"
 
 struct Triangle
 {
@@ -9,5 +13,48 @@ struct Triangle
     uint16_t attrByteCount;
 };
 
+// Binary STL layout: 80-byte header, uint32 triangle count, then one
+// 50-byte record per facet (normal, three vertices, attribute byte count)
+#define STL_HEADER_SIZE 84
+#define STL_FACET_STRIDE 50
+
+// Binary STL file mapped into memory. Facet records are read in place,
+// nothing is copied at load time.
+struct STLMapping
+{
+    struct MappedFile file;
+    const unsigned char* facets;    // first facet record
+    uint32_t numTriangles;
+    unsigned char* packed;          // ASCII facets repacked into records, or NULL
+};
+
 uint32_t readBinSTL(const char* filename, float** triangles, float** normals);
-uint32_t readAsciiSTL(const char* filename, struct Triangle** triangles);
\ No newline at end of file
+uint32_t readAsciiSTL(const char* filename, struct Triangle** triangles);
+// Same result as readAsciiSTL, but the file is mapped and split at facet
+// boundaries which are parsed in parallel (OpenMP) into one array.
+uint32_t readAsciiSTLParallel(const char* filename, struct Triangle** triangles);
+
+// Returns the number of triangles, 0 if the file could not be mapped or the
+// triangle count in the header does not match the file size.
+uint32_t mapBinSTL(const char* filename, struct STLMapping* mapping);
+void unmapBinSTL(struct STLMapping* mapping);
+// Binary files are mapped as mapBinSTL does. Files that are not a valid
+// binary STL but start with "solid" are parsed as ASCII (readAsciiSTLParallel)
+// and repacked into binary facet records, so the accessors below work on both.
+uint32_t mapSTL(const char* filename, struct STLMapping* mapping);
+
+// Strided access into the mapping. Records are 50 bytes long so the floats
+// are only 2-byte aligned; this is fine on x86 and ARMv8, which is all the
+// renderer targets.
+static inline const float* stlFacetNormal(const struct STLMapping* mapping, uint32_t i)
+{
+    return (const float*)(mapping->facets + (size_t)i * STL_FACET_STRIDE);
+}
+
+// v is 0, 1 or 2. The three vertices of a facet are contiguous.
+static inline const float* stlFacetVertex(const struct STLMapping* mapping, uint32_t i, int v)
+{
+    return (const float*)(mapping->facets + (size_t)i * STL_FACET_STRIDE + 12 + v * 12);
+}
+
+#endif
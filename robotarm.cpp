@@ -9,28 +9,44 @@
 #include <math.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stddef.h>
 #include "math3d.h"
 #include "stopwatch.hpp"
 
 #include "readstl.h"
+#include "mesh.h"
+#include "kinematics.h"
+#include "workspace.h"
+#include "reachmap.h"
+#include "ik.h"
+#include "collision.h"
+#include "sdf.h"
+#include "trajectory.h"
 
 #define LINKS_FILE_PREFIX "links/link"
-#define NUM_LINKS 5
 
 static GLfloat windowWidth  = 100.0f;  // world-coord half-width or height (depends on aspect)
 static GLfloat windowHeight = 100.0f;
 
 uint32_t numTriangles[NUM_LINKS];
-// struct Triangle *links[NUM_LINKS];
-float *links[NUM_LINKS];
-float *normals[NUM_LINKS];
-const GLfloat linkOrigins[NUM_LINKS][3] = {
-    {0, -180, 0},
-    {0, 20, 0},
-    {0, 40, 0},
-    {32.5, 120, 0},
-    {0, 115, 0}
-};
+// STL files: binary ones mapped and read in place, ASCII ones parsed once
+struct STLMapping linkMappings[NUM_LINKS];
+// welded, indexed meshes drawn by every draw mode
+struct IndexedMesh linkMeshes[NUM_LINKS];
+// collision geometry, built from the STL facets once at load time
+struct MeshBVH linkBVHs[NUM_LINKS];
+struct OrientedBox linkBoxes[NUM_LINKS];
+struct SelfCollisionPairs selfCollisionPairs;
+struct SelfCollisionState armSelfCollision;
+#define ARM_POSE_TRIES 100              // random poses tried per instanced arm
+#define CCD_TOLERANCE 0.01f             // joint moves stop this close to the sphere
+#define CCD_SEPARATION_STEPS 32         // probes per move when starting in contact
+#define MATH3D_CHECK_MATRICES 1000      // random matrices checked against the scalar kernels
+// per link distance fields for cheap clearance queries
+struct LinkSDF linkSDFs[NUM_LINKS];
+#define SDF_CELL_SIZE 2.0f
+GLfloat weldEpsilon = 0.001f;
+MeshNormalMode meshNormalMode = FacetedNormals;
 const GLfloat linkColors[NUM_LINKS][3] = {
     {1.0f, 0.0f, 0.0f},     // link 0 red
     {1.0f, 0.5f, 0.0f},     // link 1 orange
@@ -38,20 +54,47 @@ const GLfloat linkColors[NUM_LINKS][3] = {
     {0.0f, 1.0f, 0.0f},     // link 3 green
     {0.0f, 1.0f, 1.0f}      // link 4 cyan
 };
-GLfloat linkRotate[NUM_LINKS] = {0};
-const GLfloat linkRotateAxis[NUM_LINKS][3] = {
-    {0.0f, 0.0f, 0.0f},     // place holder
-    {0.0f, 1.0f, 0.0f},     // link 0-1 y axis
-    {1.0f, 0.0f, 0.0f},     // link 1-2 x axis
-    {1.0f, 0.0f, 0.0f},     // link 2-3 x axis
-    {0.0f, 1.0f, 0.0f}      // link 3-4 y axis
-};
+// joint angles of the interactive arm and its cached link matrices
+struct KinematicChain armChain;
 
 GLfloat radius = 0.0f;
 GLfloat clawLength = 0.0f;
 
+// reachable claw tip positions, sampled a slice at a time after startup
+struct WorkspaceSampler workspaceSampler;
+#define WORKSPACE_VOXEL_SIZE 10.0f
+#define WORKSPACE_MAX_STEPS 256         // per joint, finest level
+#define WORKSPACE_SLICE_SECONDS 0.01
+#define WORKSPACE_SLICE_MS 20           // between slices
+GLuint gVboEnvelope;
+GLsizei envelopeVertexCount;
+
+// precomputed with --build-reachability, used to place the target sphere
+#define REACHABILITY_FILE "links/reachability.map"
+#define PLACE_SPHERE_TRIES 1000
+struct ReachabilityMap reachabilityMap;
+bool reachabilityMapLoaded = false;
+
+// claw tip follows ikTarget, solved a little every frame
+#define IK_TOLERANCE 0.5f
+#define IK_MAX_ITERATIONS 100
+#define IK_FRAME_BUDGET_US 500.0
+bool ikActive = false;
+M3DVector3f ikTarget;
+M3DMatrix44f sceneViewMatrix;       // view of the last frame, for picking
+
+// waypoint program played on a fixed tick, see --trajectory and --simulate
+#define TRAJECTORY_TICK_SECONDS 0.001       // 1 kHz, like a robot controller
+#define TRAJECTORY_MAX_FRAME_TICKS 1000     // more than this per frame and playback slows down
+struct Trajectory trajectory;
+struct TrajectoryPlayer trajectoryPlayer;
+bool trajectoryActive = false;
+
 GLfloat sphereRadius = 81.0f;
 GLfloat sphereCenter[4] = {-200.0f, -99.0f, 200.0f, 1.0f};
+// closest arm facet inside the sphere, reported when it changes
+struct ArmContact sphereContact;
+bool sphereTouched = false;
 
 M3DVector3f groundPoints[3] = {
     { -30.0f, -180.0f, -20.0f },
@@ -60,6 +103,33 @@ M3DVector3f groundPoints[3] = {
 };
 M3DMatrix44f shadowMatrix;
 
+enum ShadowMode
+{
+    PlanarShadow,       // arm and sphere drawn a second time flattened onto the ground
+    ShadowMapShadow     // depth from the light, rendered again only when the scene changes
+};
+
+ShadowMode currentShadowMode = PlanarShadow;
+
+#define SHADOW_MAP_SIZE 2048
+GLuint gShadowFbo;
+GLuint gShadowTexture;      // depth, bound to texture unit 1
+M3DMatrix44f shadowTexMatrix;   // world to shadow map coordinates
+M3DMatrix44f eyeShadowMatrix;   // eye to shadow map coordinates, for the shaders
+bool shadowMapDirty = true;
+
+// light and material, shared by the fixed-function setup and the shader path
+const GLfloat ambientLight[]  = { 0.2f, 0.2f, 0.2f, 1.0f };
+const GLfloat diffuseLight[]  = { 0.8f, 0.8f, 0.8f, 1.0f };
+const GLfloat specularLight[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+const GLfloat lightPos[]      = { 400.0f, 400.0f, 200.0f, 0.0f }; // directional, set in eye space
+const GLfloat lightModelAmbient[] = { 0.2f, 0.2f, 0.2f, 1.0f };  // GL default
+const GLfloat matSpecular[]   = { 0.8f, 0.8f, 0.8f, 1.0f };
+const GLfloat matShininess    = 50.0f;
+
+// CPU side projection for the shader path
+M3DMatrix44f projectionMatrix;
+
 #define NUM_TEXTURES 2
 GLuint textureIDs[NUM_TEXTURES];
 
@@ -67,37 +137,305 @@ enum DrawMode
 {
     Default,
     VertexArray,
-    VBO
+    VBO,
+    VAO,
+    Shader,
+    Instanced
 };
 
 DrawMode currentDrawMode = Default;
 
-GLuint gVboLinks[NUM_LINKS];
-GLuint gVboNormals[NUM_LINKS];
+// Frames are only drawn when something changed, unless benchmarking
+bool benchmarkMode = false;
+bool animationFramePending = false;
+#define ANIMATION_FRAME_MS 16
+
+// all links share one interleaved vertex buffer and one index buffer
+GLuint gVboLinks;
+GLuint gIboLinks;
+// array setup of gVboLinks/gIboLinks recorded once, links drawn by base vertex
+GLuint gVaoLinks;
+// same buffers bound to generic attributes 0-2 for the shader path
+GLuint gVaoLinksShader;
+
+GLuint gPhongProgram;
+struct PhongUniforms
+{
+    GLint mvMatrix;
+    GLint mvpMatrix;
+    GLint color;
+    GLint useLighting;
+    GLint useTexture;
+    GLint useShadowMap;
+    GLint shadowMatrix;
+} phongUniforms;
+GLuint linkBaseVertex[NUM_LINKS];
+GLintptr linkIndexOffset[NUM_LINKS];    // bytes
+
+// multi-arm scene, every arm has its own base and joint state
+#define MAX_ARMS 10000
+struct ArmInstance
+{
+    M3DMatrix44f baseMatrix;            // arm base to world
+    struct KinematicChain chain;
+    GLfloat jointSpeeds[NUM_LINKS];     // degrees per second
+    uint32_t matrixVersion;             // chain version in instanceMatrices
+    struct SelfCollisionState selfCollision;
+};
+struct ArmInstance *armInstances;
+int numArms = 1;
+// link to world matrices, one section of MAX_ARMS matrices per link so every
+// link is drawn with a single instanced call
+GLfloat *instanceMatrices;
+GLuint gVboInstances;
+GLuint gVaoInstanced;
+
+GLuint gInstancedProgram;
+struct InstancedUniforms
+{
+    GLint viewMatrix;
+    GLint projectionMatrix;
+    GLint color;
+    GLint useLighting;
+    GLint useTexture;
+    GLint useShadowMap;
+    GLint shadowMatrix;
+} instancedUniforms;
 
-float getPointToSegmentDistance(const GLfloat p[3], const GLfloat a[3], const GLfloat b[3])
+// Point the fixed-function arrays at interleaved MeshVertex data. base is
+// either a client pointer or a byte offset into the bound VBO.
+void SetMeshVertexPointers(const GLubyte *base)
 {
-    M3DVector3f ap, ab;
-    m3dSubtractVectors3(ap, p, a);
-    m3dSubtractVectors3(ab, b, a);
-    float abLengthSq = m3dGetVectorLength(ab);
-    abLengthSq *= abLengthSq;
-    float t = (m3dDotProduct(ap, ab)) / abLengthSq;
-    if (t < 0.0f) t = 0.0f;
-    else if (t > 1.0f) t = 1.0f;
-    M3DVector3f projection;
-    projection[0] = a[0] + t * ab[0];
-    projection[1] = a[1] + t * ab[1];
-    projection[2] = a[2] + t * ab[2];
-    M3DVector3f diff;
-    m3dSubtractVectors3(diff, p, projection);
-    return m3dGetVectorLength(diff);
+    glVertexPointer(3, GL_FLOAT, sizeof(MeshVertex), base + offsetof(MeshVertex, position));
+    glNormalPointer(GL_FLOAT, sizeof(MeshVertex), base + offsetof(MeshVertex, normal));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(MeshVertex), base + offsetof(MeshVertex, texCoord));
 }
 
-void DrawRobotArm(int colorMode)
+// Same as the fixed-function paths, lit per pixel. parentMatrix takes the
+// place of the modelview stack.
+void DrawRobotArmShader(int colorMode, const M3DMatrix44f parentMatrix)
 {
-    // push matrix for arm rotation and base translation
-    glPushMatrix();
+    glUseProgram(gPhongProgram);
+    glUniform1i(phongUniforms.useLighting, colorMode);
+    glUniform1i(phongUniforms.useTexture, colorMode);
+    glUniform1i(phongUniforms.useShadowMap, colorMode && currentShadowMode == ShadowMapShadow);
+    glUniformMatrix4fv(phongUniforms.shadowMatrix, 1, GL_FALSE, eyeShadowMatrix);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[0]);
+    glBindVertexArray(gVaoLinksShader);
+
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        M3DMatrix44f mvMatrix, mvpMatrix;
+        m3dMatrixMultiply44(mvMatrix, parentMatrix, armChain.linkMatrices[i]);
+        m3dMatrixMultiply44(mvpMatrix, projectionMatrix, mvMatrix);
+        glUniformMatrix4fv(phongUniforms.mvMatrix, 1, GL_FALSE, mvMatrix);
+        glUniformMatrix4fv(phongUniforms.mvpMatrix, 1, GL_FALSE, mvpMatrix);
+        if (colorMode)
+            glUniform4f(phongUniforms.color, linkColors[i][0], linkColors[i][1], linkColors[i][2], 1.0f);
+        else
+            glUniform4f(phongUniforms.color, 0.0f, 0.0f, 0.0f, 1.0f);
+
+        const IndexedMesh *mesh = &linkMeshes[i];
+        glDrawElementsBaseVertex(GL_TRIANGLES, mesh->numIndices,
+                                 mesh->indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                                 (GLvoid *)((const GLubyte *)0 + linkIndexOffset[i]), linkBaseVertex[i]);
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// Side of the square grid holding n arms, always odd so arm 0 sits in the
+// middle
+int GetArmGridSide(int n)
+{
+    int side = 1;
+    while (side * side < n)
+        side += 2;
+    return side;
+}
+
+// Arms are placed ring by ring around the interactive arm at the origin,
+// joint angles and speeds are random.
+void SetupArmInstances(void)
+{
+    armInstances = (struct ArmInstance *)malloc(MAX_ARMS * sizeof(struct ArmInstance));
+    instanceMatrices = (GLfloat *)malloc((size_t)MAX_ARMS * NUM_LINKS * sizeof(M3DMatrix44f));
+    if (!armInstances || !instanceMatrices)
+    {
+        perror("Failed to allocate memory");
+        exit(1);
+    }
+
+    // workspaces of neighbouring arms touch but do not overlap
+    GLfloat spacing = 2.0f * radius;
+    srand(1);
+    int n = 0;
+    for (int ring = 0; n < MAX_ARMS; ++ring)
+    {
+        for (int z = -ring; z <= ring && n < MAX_ARMS; ++z)
+        {
+            for (int x = -ring; x <= ring && n < MAX_ARMS; ++x)
+            {
+                if (abs(x) != ring && abs(z) != ring)
+                    continue;
+                struct ArmInstance *arm = &armInstances[n++];
+                m3dTranslationMatrix44(arm->baseMatrix, x * spacing, 0.0f, z * spacing);
+                initKinematicChain(&arm->chain);
+                memset(&arm->selfCollision, 0, sizeof(arm->selfCollision));
+                // start from a pose without self-collision
+                for (int tries = 0; tries < ARM_POSE_TRIES; ++tries)
+                {
+                    for (int i = 1; i < NUM_LINKS; ++i)
+                        setJointAngle(&arm->chain, i, 360.0f * rand() / RAND_MAX);
+                    if (!checkSelfCollision(linkBVHs, linkBoxes, &selfCollisionPairs, &arm->chain,
+                                            &arm->selfCollision))
+                        break;
+                }
+                for (int i = 1; i < NUM_LINKS; ++i)
+                    arm->jointSpeeds[i] = 60.0f * rand() / RAND_MAX - 30.0f;
+                arm->jointSpeeds[0] = 0.0f;
+                // nothing in instanceMatrices yet
+                arm->matrixVersion = arm->chain.version - 1;
+            }
+        }
+    }
+
+    glGenBuffers(1, &gVboInstances);
+    glBindBuffer(GL_ARRAY_BUFFER, gVboInstances);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)MAX_ARMS * NUM_LINKS * sizeof(M3DMatrix44f), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Advance every arm by dt seconds, bring its link matrices up to date and
+// upload them. Arm 0 follows the keyboard. Arms whose chain did not change
+// keep their matrices from the last frame.
+void UpdateArmInstances(float dt)
+{
+    for (int i = 0; i < NUM_LINKS; ++i)
+        setJointAngle(&armInstances[0].chain, i, armChain.jointAngles[i]);
+
+    #pragma omp parallel for schedule(static)
+    for (int a = 0; a < numArms; ++a)
+    {
+        struct ArmInstance *arm = &armInstances[a];
+        if (a != 0)
+        {
+            GLfloat previousAngles[NUM_LINKS];
+            memcpy(previousAngles, arm->chain.jointAngles, sizeof(previousAngles));
+            bool wasColliding = arm->selfCollision.valid && arm->selfCollision.colliding;
+            for (int i = 1; i < NUM_LINKS; ++i)
+            {
+                if (arm->jointSpeeds[i] == 0.0f)
+                    continue;
+                GLfloat angle = fmodf(arm->chain.jointAngles[i] + arm->jointSpeeds[i] * dt, 360.0f);
+                if (angle < 0)
+                    angle += 360.0f;
+                setJointAngle(&arm->chain, i, angle);
+            }
+            // bounce off itself: undo the step and turn every joint around
+            if (!wasColliding &&
+                checkSelfCollision(linkBVHs, linkBoxes, &selfCollisionPairs, &arm->chain, &arm->selfCollision))
+            {
+                for (int i = 1; i < NUM_LINKS; ++i)
+                {
+                    setJointAngle(&arm->chain, i, previousAngles[i]);
+                    arm->jointSpeeds[i] = -arm->jointSpeeds[i];
+                }
+                arm->selfCollision.valid = 0;
+            }
+        }
+
+        updateKinematicChain(&arm->chain);
+        if (arm->matrixVersion == arm->chain.version)
+            continue;
+        for (int i = 0; i < NUM_LINKS; ++i)
+            m3dMatrixMultiply44(&instanceMatrices[((size_t)i * MAX_ARMS + a) * 16], arm->baseMatrix,
+                                arm->chain.linkMatrices[i]);
+        arm->matrixVersion = arm->chain.version;
+    }
+
+    // orphan last frame's storage instead of waiting for the draws using it
+    glBindBuffer(GL_ARRAY_BUFFER, gVboInstances);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)MAX_ARMS * NUM_LINKS * sizeof(M3DMatrix44f), NULL, GL_STREAM_DRAW);
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)i * MAX_ARMS * sizeof(M3DMatrix44f),
+                        numArms * sizeof(M3DMatrix44f), &instanceMatrices[(size_t)i * MAX_ARMS * 16]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Every link drawn once for all arms. viewMatrix takes the place of the
+// modelview stack, as in DrawRobotArmShader.
+void DrawRobotArmInstanced(int colorMode, const M3DMatrix44f viewMatrix)
+{
+    glUseProgram(gInstancedProgram);
+    glUniformMatrix4fv(instancedUniforms.viewMatrix, 1, GL_FALSE, viewMatrix);
+    glUniformMatrix4fv(instancedUniforms.projectionMatrix, 1, GL_FALSE, projectionMatrix);
+    glUniform1i(instancedUniforms.useLighting, colorMode);
+    glUniform1i(instancedUniforms.useTexture, colorMode);
+    glUniform1i(instancedUniforms.useShadowMap, colorMode && currentShadowMode == ShadowMapShadow);
+    glUniformMatrix4fv(instancedUniforms.shadowMatrix, 1, GL_FALSE, eyeShadowMatrix);
+    glBindTexture(GL_TEXTURE_2D, textureIDs[0]);
+    glBindVertexArray(gVaoInstanced);
+    glBindBuffer(GL_ARRAY_BUFFER, gVboInstances);
+
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        // point the matrix columns at this link's section
+        const GLubyte *section = (const GLubyte *)0 + (size_t)i * MAX_ARMS * sizeof(M3DMatrix44f);
+        for (int c = 0; c < 4; ++c)
+            glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(M3DMatrix44f), section + c * 4 * sizeof(GLfloat));
+
+        if (colorMode)
+            glUniform4f(instancedUniforms.color, linkColors[i][0], linkColors[i][1], linkColors[i][2], 1.0f);
+        else
+            glUniform4f(instancedUniforms.color, 0.0f, 0.0f, 0.0f, 1.0f);
+
+        const IndexedMesh *mesh = &linkMeshes[i];
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh->numIndices,
+                                          mesh->indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                                          (GLvoid *)((const GLubyte *)0 + linkIndexOffset[i]), numArms,
+                                          linkBaseVertex[i]);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// parentMatrix is the current modelview, only needed by the shader paths
+void DrawRobotArm(int colorMode, const M3DMatrix44f parentMatrix)
+{
+    if (currentDrawMode == Shader)
+    {
+        DrawRobotArmShader(colorMode, parentMatrix);
+        return;
+    }
+    if (currentDrawMode == Instanced)
+    {
+        DrawRobotArmInstanced(colorMode, parentMatrix);
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, textureIDs[0]);
+    if (currentDrawMode == VertexArray || currentDrawMode == VBO)
+    {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+    if (currentDrawMode == VBO)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, gVboLinks);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIboLinks);
+    }
+    else if (currentDrawMode == VAO)
+    {
+        glBindVertexArray(gVaoLinks);
+    }
+
     for (int i = 0; i < NUM_LINKS; ++i)
     {
         // draw link
@@ -109,125 +447,423 @@ void DrawRobotArm(int colorMode)
         {
             glColor3f(0.0f, 0.0f, 0.0f);
         }
-        glTranslatef(linkOrigins[i][0], linkOrigins[i][1], linkOrigins[i][2]);
-        glRotatef(linkRotate[i], linkRotateAxis[i][0], linkRotateAxis[i][1], linkRotateAxis[i][2]);
+        // link to arm base from the kinematics cache
+        glPushMatrix();
+        glMultMatrixf(armChain.linkMatrices[i]);
 
-        glBindTexture(GL_TEXTURE_2D, textureIDs[0]);
+        const IndexedMesh *mesh = &linkMeshes[i];
+        GLenum indexType = mesh->indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
         switch(currentDrawMode)
         {
             case Default:
                 glBegin(GL_TRIANGLES);
-                for (uint32_t j = 0; j < numTriangles[i]; ++j)
+                for (uint32_t j = 0; j < mesh->numIndices; ++j)
                 {
-                    glNormal3fv(&normals[i][j * 3]);
-                    glTexCoord2f(0.0f, 0.0f);
-                    glVertex3fv(&links[i][j * 9]);
-                    glTexCoord2f(1.0f, 0.0f);
-                    glVertex3fv(&links[i][j * 9 + 3]);
-                    glTexCoord2f(0.5f, 1.0f);
-                    glVertex3fv(&links[i][j * 9 + 6]);
+                    const MeshVertex *v = &mesh->vertices[getMeshIndex(mesh, j)];
+                    glNormal3fv(v->normal);
+                    glTexCoord2fv(v->texCoord);
+                    glVertex3fv(v->position);
                 }
                 glEnd();
                 break;
             case VertexArray:
-                glEnableClientState(GL_VERTEX_ARRAY);
-                glEnableClientState(GL_NORMAL_ARRAY);
-                glVertexPointer(3, GL_FLOAT, 0, &links[i][0]);
-                glNormalPointer(GL_FLOAT, 0, &normals[i][0]);
-                glDrawArrays(GL_TRIANGLES, 0, numTriangles[i] * 3);
-                glDisableClientState(GL_VERTEX_ARRAY);
-                glDisableClientState(GL_NORMAL_ARRAY);
+                SetMeshVertexPointers((const GLubyte *)mesh->vertices);
+                glDrawElements(GL_TRIANGLES, mesh->numIndices, indexType, mesh->indices);
                 break;
             case VBO:
-                glEnableClientState(GL_VERTEX_ARRAY);
-                glBindBuffer(GL_ARRAY_BUFFER, gVboLinks[i]);
-                glVertexPointer(3, GL_FLOAT, 0, 0);
-                glEnableClientState(GL_NORMAL_ARRAY);
-                glBindBuffer(GL_ARRAY_BUFFER, gVboNormals[i]);
-                glNormalPointer(GL_FLOAT, 0, 0);
-                glDrawArrays(GL_TRIANGLES, 0, numTriangles[i] * 3);
-                glDisableClientState(GL_VERTEX_ARRAY);
-                glDisableClientState(GL_NORMAL_ARRAY);
-                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                SetMeshVertexPointers((const GLubyte *)0 + linkBaseVertex[i] * sizeof(MeshVertex));
+                glDrawElements(GL_TRIANGLES, mesh->numIndices, indexType, (const GLubyte *)0 + linkIndexOffset[i]);
+                break;
+            case VAO:
+                glDrawElementsBaseVertex(GL_TRIANGLES, mesh->numIndices, indexType,
+                                         (GLvoid *)((const GLubyte *)0 + linkIndexOffset[i]), linkBaseVertex[i]);
+                break;
+            default:
                 break;
         }
+        glPopMatrix();
+    }
+
+    if (currentDrawMode == VBO)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    else if (currentDrawMode == VAO)
+    {
+        glBindVertexArray(0);
+    }
+    if (currentDrawMode == VertexArray || currentDrawMode == VBO)
+    {
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
     }
-    // pop arm rotation and base translation
-    glPopMatrix();
 }
 
-void RenderScene(void)
+// Half extent of everything that casts or receives shadows
+GLfloat GetShadowSceneRadius(void)
 {
-    static int iFrames = 0;
-    static CStopWatch frameTimer;
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glMatrixMode(GL_MODELVIEW);
+    GLfloat sceneRadius = fmaxf(radius, m3dGetVectorLength(sphereCenter) + sphereRadius);
+    if (currentDrawMode == Instanced)
+        sceneRadius *= GetArmGridSide(numArms);
+    return sceneRadius;
+}
+
+// Render the arm and the target sphere into the shadow map from the light
+// (lightPos, in world space like the planar shadow) and update
+// shadowTexMatrix.
+void RenderShadowMap(void)
+{
+    GLfloat sceneRadius = GetShadowSceneRadius();
+    M3DVector3f lightDir = { lightPos[0], lightPos[1], lightPos[2] };
+    m3dNormalizeVector(lightDir);
 
+    M3DMatrix44f lightProjection, lightView, savedProjection;
+    glMatrixMode(GL_PROJECTION);
     glPushMatrix();
-    #define SCALE 0.2f
-    glScalef(SCALE, SCALE, SCALE);
-    #undef SCALE
-    glRotatef(30.0f, 1.0f, 0.0f, 0.0f);     // rotate x
-    glRotatef(-30.0f, 0.0f, 1.0f, 0.0f);    // rotate y
+    glLoadIdentity();
+    glOrtho(-sceneRadius, sceneRadius, -sceneRadius, sceneRadius, 0.0, 4.0 * sceneRadius);
+    glGetFloatv(GL_PROJECTION_MATRIX, lightProjection);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    gluLookAt(lightDir[0] * 2.0f * sceneRadius, lightDir[1] * 2.0f * sceneRadius, lightDir[2] * 2.0f * sceneRadius,
+              0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+    glGetFloatv(GL_MODELVIEW_MATRIX, lightView);
+    // the shader paths build their own matrices
+    m3dCopyMatrix44(savedProjection, projectionMatrix);
+    m3dCopyMatrix44(projectionMatrix, lightProjection);
 
-    // draw robot arm shadow
+    glBindFramebuffer(GL_FRAMEBUFFER, gShadowFbo);
+    glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    glClear(GL_DEPTH_BUFFER_BIT);
     glDisable(GL_LIGHTING);
-    glDisable(GL_DEPTH_TEST);
     glDisable(GL_TEXTURE_2D);
+    // back faces only, pushed away a bit, keeps lit faces from shadowing themselves
+    glCullFace(GL_FRONT);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.0f, 2.0f);
+
+    DrawRobotArm(0, lightView);
     glPushMatrix();
-    glMultMatrixf((GLfloat *)shadowMatrix);
-    DrawRobotArm(0);
+    glTranslatef(sphereCenter[0], sphereCenter[1], sphereCenter[2]);
+    gltDrawSphereBatch(sphereRadius, 30, 30);
     glPopMatrix();
-    glEnable(GL_DEPTH_TEST);
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glCullFace(GL_BACK);
     glEnable(GL_LIGHTING);
     glEnable(GL_TEXTURE_2D);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
 
-    // draw target sphere shadow
-    glDisable(GL_LIGHTING);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_TEXTURE_2D);
-    glPushMatrix();
-    glMultMatrixf((GLfloat *)shadowMatrix);
-    glTranslatef(sphereCenter[0], sphereCenter[1], sphereCenter[2]);
-    glColor3f(0.0f, 0.0f, 0.0f);
-    glutSolidSphere(sphereRadius, 30, 30);
+    m3dCopyMatrix44(projectionMatrix, savedProjection);
     glPopMatrix();
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+
+    // clip space [-1, 1] to texture space [0, 1]
+    M3DMatrix44f biasMatrix = { 0.5f, 0.0f, 0.0f, 0.0f,
+                                0.0f, 0.5f, 0.0f, 0.0f,
+                                0.0f, 0.0f, 0.5f, 0.0f,
+                                0.5f, 0.5f, 0.5f, 1.0f };
+    M3DMatrix44f tempMatrix;
+    m3dMatrixMultiply44(tempMatrix, biasMatrix, lightProjection);
+    m3dMatrixMultiply44(shadowTexMatrix, tempMatrix, lightView);
+}
+
+// Shadow map lookup on texture unit 1 for the fixed-function paths. Must be
+// called with the view matrix on the modelview stack, GL transforms the eye
+// planes by its inverse.
+void EnableShadowMapTexGen(void)
+{
+    glActiveTexture(GL_TEXTURE1);
     glEnable(GL_TEXTURE_2D);
+    const GLenum coords[4] = { GL_S, GL_T, GL_R, GL_Q };
+    const GLenum gens[4] = { GL_TEXTURE_GEN_S, GL_TEXTURE_GEN_T, GL_TEXTURE_GEN_R, GL_TEXTURE_GEN_Q };
+    for (int i = 0; i < 4; ++i)
+    {
+        // rows of shadowTexMatrix
+        GLfloat plane[4] = { shadowTexMatrix[i], shadowTexMatrix[4 + i], shadowTexMatrix[8 + i], shadowTexMatrix[12 + i] };
+        glTexGenfv(coords[i], GL_EYE_PLANE, plane);
+        glEnable(gens[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
 
-    // draw robot arm
-    glBindTexture(GL_TEXTURE_2D, textureIDs[0]);
-    DrawRobotArm(1);
+void DisableShadowMapTexGen(void)
+{
+    glActiveTexture(GL_TEXTURE1);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_TEXTURE_GEN_S);
+    glDisable(GL_TEXTURE_GEN_T);
+    glDisable(GL_TEXTURE_GEN_R);
+    glDisable(GL_TEXTURE_GEN_Q);
+    glActiveTexture(GL_TEXTURE0);
+}
 
-    // calculate claw segment transform matrix
-    M3DMatrix44f transformMatrix, currentMatrix, tempMatrix;
-    m3dLoadIdentity44(currentMatrix);
-    for (int i = 0; i < NUM_LINKS; ++i)
+// Receiver for the shadow map, on the plane of groundPoints
+void DrawGround(void)
+{
+    GLfloat size = GetShadowSceneRadius();
+    GLfloat y = groundPoints[0][1];
+    glDisable(GL_TEXTURE_2D);
+    glColor3f(0.6f, 0.6f, 0.6f);
+    glBegin(GL_QUADS);
+    glNormal3f(0.0f, 1.0f, 0.0f);
+    glVertex3f(-size, y, -size);
+    glVertex3f(-size, y, size);
+    glVertex3f(size, y, size);
+    glVertex3f(size, y, -size);
+    glEnd();
+    glEnable(GL_TEXTURE_2D);
+}
+
+// Voxel faces of the sampled workspace, in arm base coordinates
+void DrawWorkspaceEnvelope(void)
+{
+    if (envelopeVertexCount == 0)
+        return;
+    glBindBuffer(GL_ARRAY_BUFFER, gVboEnvelope);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 6 * sizeof(GLfloat), 0);
+    glNormalPointer(GL_FLOAT, 6 * sizeof(GLfloat), (const GLubyte *)0 + 3 * sizeof(GLfloat));
+    glDrawArrays(GL_QUADS, 0, envelopeVertexCount);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// One time slice of workspace sampling. The envelope is rebuilt whenever
+// new voxels were found, so it fills in while the viewer is running.
+void RefineWorkspace(int value)
+{
+    int found = stepWorkspaceSampler(&workspaceSampler, WORKSPACE_SLICE_SECONDS);
+    if (found < 0)
+        return;
+    if (found)
+    {
+        GLfloat *vertices;
+        envelopeVertexCount = buildWorkspaceEnvelope(&workspaceSampler, &vertices);
+        glBindBuffer(GL_ARRAY_BUFFER, gVboEnvelope);
+        glBufferData(GL_ARRAY_BUFFER, envelopeVertexCount * 6 * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        free(vertices);
+        glutPostRedisplay();
+    }
+
+    if (!workspaceSampler.done)
+        glutTimerFunc(WORKSPACE_SLICE_MS, RefineWorkspace, 0);
+    else
+        printf("Workspace: %u voxels from %llu samples\n", workspaceSampler.numVoxels,
+               (unsigned long long)workspaceSampler.numSamples);
+}
+
+// Instanced arms move on their own, everything else only changes on input
+bool IsAnimating(void)
+{
+    return (currentDrawMode == Instanced && numArms > 1) || ikActive || trajectoryActive;
+}
+
+void AnimationTimer(int value)
+{
+    animationFramePending = false;
+    glutPostRedisplay();
+}
+
+// Run the IK solver on the interactive arm within the frame budget. Stops
+// once the tip is on the target or no closer position can be found.
+void StepArmIK(void)
+{
+    GLfloat angles[NUM_LINKS], previousAngles[NUM_LINKS];
+    memcpy(angles, armChain.jointAngles, sizeof(angles));
+    memcpy(previousAngles, armChain.jointAngles, sizeof(previousAngles));
+    bool wasColliding = checkSelfCollision(linkBVHs, linkBoxes, &selfCollisionPairs, &armChain, &armSelfCollision);
+    struct IKResult result;
+    solveClawIK(angles, ikTarget, clawLength, IK_TOLERANCE, IK_MAX_ITERATIONS, IK_FRAME_BUDGET_US, &result);
+    for (int i = 1; i < NUM_LINKS; ++i)
+        setJointAngle(&armChain, i, angles[i]);
+    if (!wasColliding && checkSelfCollision(linkBVHs, linkBoxes, &selfCollisionPairs, &armChain, &armSelfCollision))
+    {
+        printf("IK stopped, link %d would hit link %d\n", armSelfCollision.links[1] + 1,
+               armSelfCollision.links[0] + 1);
+        for (int i = 1; i < NUM_LINKS; ++i)
+            setJointAngle(&armChain, i, previousAngles[i]);
+        ikActive = false;
+        return;
+    }
+    if (result.status == IKUnfinished)
+        return;
+    ikActive = false;
+    if (result.status == IKStalled)
+        printf("IK target out of reach, claw stopped %.2f away\n", result.error);
+}
+
+void StartArmIK(const GLfloat target[3])
+{
+    m3dCopyVector3(ikTarget, target);
+    ikActive = true;
+    trajectoryActive = false;
+    glutPostRedisplay();
+}
+
+// Start the loaded trajectory, from the beginning once it has finished, or
+// pause it
+void ToggleTrajectory(void)
+{
+    if (trajectory.numWaypoints == 0)
+    {
+        printf("No trajectory, run with --trajectory <file> to load one\n");
+        return;
+    }
+    trajectoryActive = !trajectoryActive;
+    if (trajectoryActive && trajectoryPlayer.done)
+        initTrajectoryPlayer(&trajectoryPlayer, &trajectory, TRAJECTORY_TICK_SECONDS);
+    ikActive = false;
+}
+
+// Called after every frame. Input handlers post their own redisplay, so an
+// idle viewer sleeps in glutMainLoop.
+void ScheduleNextFrame(void)
+{
+    if (benchmarkMode)
+    {
+        glutPostRedisplay();
+    }
+    else if (IsAnimating() && !animationFramePending)
+    {
+        animationFramePending = true;
+        glutTimerFunc(ANIMATION_FRAME_MS, AnimationTimer, 0);
+    }
+}
+
+void RenderScene(void)
+{
+    static int iFrames = 0;
+    static CStopWatch frameTimer;
+    static CStopWatch animationTimer;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glMatrixMode(GL_MODELVIEW);
+
+    // view: scale, rotate x, rotate y
+    M3DMatrix44f viewMatrix, shadowViewMatrix, transformMatrix, tempMatrix;
+    #define SCALE 0.2f
+    // zoom out until the whole arm grid fits
+    GLfloat viewScale = SCALE;
+    if (currentDrawMode == Instanced)
+        viewScale /= GetArmGridSide(numArms);
+    m3dLoadIdentity44(viewMatrix);
+    m3dScaleMatrix44(viewMatrix, viewScale, viewScale, viewScale);
+    #undef SCALE
+    m3dRotationMatrix44(transformMatrix, m3dDegToRad(30.0f), 1.0f, 0.0f, 0.0f);
+    m3dMatrixMultiply44(tempMatrix, viewMatrix, transformMatrix);
+    m3dRotationMatrix44(transformMatrix, m3dDegToRad(-30.0f), 0.0f, 1.0f, 0.0f);
+    m3dMatrixMultiply44(viewMatrix, tempMatrix, transformMatrix);
+    m3dMatrixMultiply44(shadowViewMatrix, viewMatrix, shadowMatrix);
+    m3dCopyMatrix44(sceneViewMatrix, viewMatrix);
+
+    if (ikActive)
+    {
+        StepArmIK();
+        shadowMapDirty = true;
+    }
+    float dt = animationTimer.GetElapsedSeconds();
+    animationTimer.Reset();
+    // first frame after being idle
+    if (dt > 0.1f)
+        dt = 0.1f;
+    if (currentDrawMode == Instanced)
+        UpdateArmInstances(dt);
+    // the simulation runs on its own tick, frames only show its latest state
+    if (trajectoryActive)
+    {
+        advanceTrajectoryPlayer(&trajectoryPlayer, dt, TRAJECTORY_MAX_FRAME_TICKS, &armChain);
+        shadowMapDirty = true;
+        if (trajectoryPlayer.done)
+        {
+            trajectoryActive = false;
+            printf("Trajectory finished after %.3f s\n", getTrajectoryPlayerTime(&trajectoryPlayer));
+        }
+    }
+    // after IK and playback moved the joints: the passes below read the
+    // link matrices directly
+    updateKinematicChain(&armChain);
+
+    if (currentShadowMode == ShadowMapShadow)
+    {
+        // instanced arms move every frame
+        if (shadowMapDirty || currentDrawMode == Instanced)
+        {
+            RenderShadowMap();
+            shadowMapDirty = false;
+        }
+        // scaled, so affine rather than rigid
+        M3DMatrix44f inverseViewMatrix;
+        m3dInvertAffineMatrix44(inverseViewMatrix, viewMatrix);
+        m3dMatrixMultiply44(eyeShadowMatrix, shadowTexMatrix, inverseViewMatrix);
+    }
+
+    glPushMatrix();
+    glMultMatrixf(viewMatrix);
+
+    if (currentShadowMode == ShadowMapShadow)
+    {
+        EnableShadowMapTexGen();
+        DrawGround();
+    }
+    else
     {
-        m3dTranslationMatrix44(transformMatrix, linkOrigins[i][0], linkOrigins[i][1], linkOrigins[i][2]);
-        m3dMatrixMultiply44(tempMatrix, currentMatrix, transformMatrix);
-        m3dRotationMatrix44(transformMatrix, m3dDegToRad(linkRotate[i]), linkRotateAxis[i][0], linkRotateAxis[i][1], linkRotateAxis[i][2]);
-        m3dMatrixMultiply44(currentMatrix, tempMatrix, transformMatrix);
+        // draw robot arm shadow
+        glDisable(GL_LIGHTING);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_TEXTURE_2D);
+        glPushMatrix();
+        glMultMatrixf((GLfloat *)shadowMatrix);
+        DrawRobotArm(0, shadowViewMatrix);
+        glPopMatrix();
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_LIGHTING);
+        glEnable(GL_TEXTURE_2D);
+
+        // draw target sphere shadow
+        glDisable(GL_LIGHTING);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_TEXTURE_2D);
+        glPushMatrix();
+        glMultMatrixf((GLfloat *)shadowMatrix);
+        glTranslatef(sphereCenter[0], sphereCenter[1], sphereCenter[2]);
+        glColor3f(0.0f, 0.0f, 0.0f);
+        gltDrawSphereBatch(sphereRadius, 30, 30);
+        glPopMatrix();
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_LIGHTING);
+        glEnable(GL_TEXTURE_2D);
     }
-    
-    // calculate claw segment positions
-    M3DVector4f originPos = {0.0f, 0.0f, 0.0f, 1.0f}, clawPos;
-    m3dTransformVector4(clawPos, originPos, currentMatrix);
-    // add claw length to get claw end position
-    M3DVector4f clawEndPos;
-    m3dTranslationMatrix44(transformMatrix, 0.0f, clawLength, 0.0f);
-    m3dMatrixMultiply44(tempMatrix, currentMatrix, transformMatrix);
-    m3dTransformVector4(clawEndPos, originPos, tempMatrix);
 
-    // calculate distance from claw segment to sphere center
-    float distToSphere = getPointToSegmentDistance(sphereCenter, clawPos, clawEndPos);
+    // draw robot arm
+    glBindTexture(GL_TEXTURE_2D, textureIDs[0]);
+    DrawRobotArm(1, viewMatrix);
+
+    // sphere against the real link meshes, joint moves stop within
+    // CCD_TOLERANCE of it
+    struct ArmContact contact;
+    bool touched = findArmSphereContact(linkBVHs, &armChain, sphereCenter, sphereRadius + CCD_TOLERANCE, &contact);
+    // reported when it starts or moves to another link or facet, not every frame
+    if (touched && (!sphereTouched || contact.link != sphereContact.link || contact.facet != sphereContact.facet))
+        printf("Sphere touches link %d, facet %u, %.2f from its center\n", contact.link + 1, contact.facet,
+               contact.distance);
+    sphereTouched = touched;
+    if (touched)
+        sphereContact = contact;
 
     // draw target sphere
     glPushMatrix();
     glTranslatef(sphereCenter[0], sphereCenter[1], sphereCenter[2]);
     // switch color if claw touches sphere
-    if (distToSphere <= sphereRadius)
+    if (sphereTouched)
     {
         glColor3ub(151, 160, 155);
         glBindTexture(GL_TEXTURE_2D, textureIDs[1]);
@@ -238,52 +874,45 @@ void RenderScene(void)
         glBindTexture(GL_TEXTURE_2D, textureIDs[0]);
     }
 
-    // glutSolidSphere(sphereRadius, 30, 30);
-    gltDrawSphere(sphereRadius, 30, 30);
+    gltDrawSphereBatch(sphereRadius, 30, 30);
     glPopMatrix();
 
-    // draw claw segment for debugging
-    // glDisable(GL_LIGHTING);
-    // glDisable(GL_DEPTH_TEST);
-    // glLineWidth(5.0f);
-    // glColor3f(1.0f, 1.0f, 1.0f);
-    // glBegin(GL_LINES);
-    // glVertex3f(clawPos[0], clawPos[1], clawPos[2]);
-    // glVertex3f(clawEndPos[0], clawEndPos[1], clawEndPos[2]);
-    // glEnd();
-    // glEnable(GL_DEPTH_TEST);
-    // glEnable(GL_LIGHTING);
-
-    // draw workspace sphere
-    // translate to first origin as sphere center
-    glTranslatef(linkOrigins[0][0], linkOrigins[0][1], linkOrigins[0][2]);
-
-    // disable lighting for the sphere
-    glDisable(GL_LIGHTING);
+    if (currentShadowMode == ShadowMapShadow)
+        DisableShadowMapTexGen();
+
+    // draw sampled workspace envelope, lit so its shape shows
     glDisable(GL_TEXTURE_2D);
 
-    // enable blending for transparency
+    // enable blending for transparency, faces behind stay visible
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_BLEND);
+    glDepthMask(GL_FALSE);
     glColor4f(1.0f, 1.0f, 1.0f, 0.4f);
 
-    // glutSolidSphere(radius, 30, 30);
-    gltDrawSphere(radius, 30, 30);
+    DrawWorkspaceEnvelope();
+    glDepthMask(GL_TRUE);
     glDisable(GL_BLEND);
-    glEnable(GL_LIGHTING);
     glEnable(GL_TEXTURE_2D);
 
     glPopMatrix();
 
     glutSwapBuffers();
+    ScheduleNextFrame();
 
+    // frame rate only means something while redrawing continuously
+    if (!benchmarkMode)
+    {
+        frameTimer.Reset();
+        iFrames = 0;
+        return;
+    }
     iFrames++;
 
     // Do periodic frame rate calculation
     if(iFrames == 100)
     {
         float fps;
-        char cBuffer[64];
+        char cBuffer[80];
         
         fps = 100.0f / frameTimer.GetElapsedSeconds();
         switch (currentDrawMode)
@@ -297,6 +926,15 @@ void RenderScene(void)
             case VBO:
                 sprintf(cBuffer,"Robot Arm with VBO %.1f fps", fps);
                 break;
+            case VAO:
+                sprintf(cBuffer,"Robot Arm with VBO + VAO %.1f fps", fps);
+                break;
+            case Shader:
+                sprintf(cBuffer,"Robot Arm with Shaders %.1f fps", fps);
+                break;
+            case Instanced:
+                sprintf(cBuffer,"%d Robot Arms Instanced %.1f fps", numArms, fps);
+                break;
         }
             
         glutSetWindowTitle(cBuffer);
@@ -307,6 +945,193 @@ void RenderScene(void)
 
 }
 
+void SetupLinkBuffers(void)
+{
+    if (gVboLinks == 0)
+    {
+        glGenBuffers(1, &gVboLinks);
+        glGenBuffers(1, &gIboLinks);
+    }
+
+    GLsizeiptr vertexBytes = 0, indexBytes = 0;
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        linkBaseVertex[i] = vertexBytes / sizeof(MeshVertex);
+        linkIndexOffset[i] = indexBytes;
+        vertexBytes += linkMeshes[i].numVertices * sizeof(MeshVertex);
+        // keep 32-bit index ranges 4-byte aligned
+        indexBytes += (linkMeshes[i].numIndices * linkMeshes[i].indexSize + 3) & ~3;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, gVboLinks);
+    glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIboLinks);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, linkBaseVertex[i] * sizeof(MeshVertex),
+                        linkMeshes[i].numVertices * sizeof(MeshVertex), linkMeshes[i].vertices);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, linkIndexOffset[i],
+                        linkMeshes[i].numIndices * linkMeshes[i].indexSize, linkMeshes[i].indices);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // the buffer names never change, so the vertex array object is recorded once
+    if (gVaoLinks == 0)
+    {
+        glGenVertexArrays(1, &gVaoLinks);
+        glBindVertexArray(gVaoLinks);
+        glBindBuffer(GL_ARRAY_BUFFER, gVboLinks);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIboLinks);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        SetMeshVertexPointers(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+}
+
+// Light and material never change, they are set once per program
+void SetLightingUniforms(GLuint program)
+{
+    M3DVector3f lightDirection = { lightPos[0], lightPos[1], lightPos[2] };
+    m3dNormalizeVector(lightDirection);
+    glUseProgram(program);
+    glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, lightDirection);
+    glUniform4fv(glGetUniformLocation(program, "lightAmbient"), 1, ambientLight);
+    glUniform4fv(glGetUniformLocation(program, "lightDiffuse"), 1, diffuseLight);
+    glUniform4fv(glGetUniformLocation(program, "lightSpecular"), 1, specularLight);
+    glUniform4fv(glGetUniformLocation(program, "lightModelAmbient"), 1, lightModelAmbient);
+    glUniform4fv(glGetUniformLocation(program, "materialSpecular"), 1, matSpecular);
+    glUniform1f(glGetUniformLocation(program, "materialShininess"), matShininess);
+    glUniform1i(glGetUniformLocation(program, "colorMap"), 0);
+    glUniform1i(glGetUniformLocation(program, "shadowMap"), 1);
+    glUseProgram(0);
+}
+
+// Mesh attributes 0-2 of the link buffers, bound into the current VAO
+void SetMeshVertexAttributes(void)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, gVboLinks);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gIboLinks);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (GLvoid *)offsetof(MeshVertex, position));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (GLvoid *)offsetof(MeshVertex, normal));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (GLvoid *)offsetof(MeshVertex, texCoord));
+}
+
+void SetupShaders(void)
+{
+    gPhongProgram = (GLuint)gltLoadShaderPair("shaders/phong.vs", "shaders/phong.fs");
+    if (gPhongProgram == 0)
+    {
+        fprintf(stderr, "Failed to load shaders/phong.vs, shaders/phong.fs; shader mode disabled\n");
+    }
+    else
+    {
+        phongUniforms.mvMatrix = glGetUniformLocation(gPhongProgram, "mvMatrix");
+        phongUniforms.mvpMatrix = glGetUniformLocation(gPhongProgram, "mvpMatrix");
+        phongUniforms.color = glGetUniformLocation(gPhongProgram, "color");
+        phongUniforms.useLighting = glGetUniformLocation(gPhongProgram, "useLighting");
+        phongUniforms.useTexture = glGetUniformLocation(gPhongProgram, "useTexture");
+        phongUniforms.useShadowMap = glGetUniformLocation(gPhongProgram, "useShadowMap");
+        phongUniforms.shadowMatrix = glGetUniformLocation(gPhongProgram, "shadowMatrix");
+        SetLightingUniforms(gPhongProgram);
+
+        glGenVertexArrays(1, &gVaoLinksShader);
+        glBindVertexArray(gVaoLinksShader);
+        SetMeshVertexAttributes();
+        glBindVertexArray(0);
+    }
+
+    gInstancedProgram = (GLuint)gltLoadShaderPair("shaders/instanced.vs", "shaders/phong.fs");
+    if (gInstancedProgram == 0)
+    {
+        fprintf(stderr, "Failed to load shaders/instanced.vs, shaders/phong.fs; instanced mode disabled\n");
+    }
+    else
+    {
+        instancedUniforms.viewMatrix = glGetUniformLocation(gInstancedProgram, "viewMatrix");
+        instancedUniforms.projectionMatrix = glGetUniformLocation(gInstancedProgram, "projectionMatrix");
+        instancedUniforms.color = glGetUniformLocation(gInstancedProgram, "color");
+        instancedUniforms.useLighting = glGetUniformLocation(gInstancedProgram, "useLighting");
+        instancedUniforms.useTexture = glGetUniformLocation(gInstancedProgram, "useTexture");
+        instancedUniforms.useShadowMap = glGetUniformLocation(gInstancedProgram, "useShadowMap");
+        instancedUniforms.shadowMatrix = glGetUniformLocation(gInstancedProgram, "shadowMatrix");
+        SetLightingUniforms(gInstancedProgram);
+
+        SetupArmInstances();
+        // per-instance matrix columns, pointers are moved per link when drawing
+        glGenVertexArrays(1, &gVaoInstanced);
+        glBindVertexArray(gVaoInstanced);
+        SetMeshVertexAttributes();
+        for (int c = 0; c < 4; ++c)
+        {
+            glEnableVertexAttribArray(3 + c);
+            glVertexAttribDivisor(3 + c, 1);
+        }
+        glBindVertexArray(0);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void BuildLinkMeshes(void)
+{
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        freeIndexedMesh(&linkMeshes[i]);
+        buildIndexedMesh(&linkMappings[i], weldEpsilon, meshNormalMode, &linkMeshes[i]);
+        printf("Link %d: %d vertices welded to %d, %d-bit indices\n", i + 1, numTriangles[i] * 3,
+               linkMeshes[i].numVertices, linkMeshes[i].indexSize * 8);
+    }
+}
+
+// Depth texture on texture unit 1 and the framebuffer rendering into it.
+// Unit 1 keeps this texture bound, the fixed-function paths only enable it.
+void SetupShadowMap(void)
+{
+    glGenTextures(1, &gShadowTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, gShadowTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // lookups return 1 when lit, 0 when in shadow
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(GL_TEXTURE_2D, GL_DEPTH_TEXTURE_MODE, GL_LUMINANCE);
+    // fixed function: darken whatever unit 0 produced
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+    glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+    glTexGeni(GL_R, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+    glTexGeni(GL_Q, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+    glActiveTexture(GL_TEXTURE0);
+
+    glGenFramebuffers(1, &gShadowFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, gShadowFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gShadowTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "Shadow map framebuffer incomplete; shadow map mode disabled\n");
+        glDeleteFramebuffers(1, &gShadowFbo);
+        gShadowFbo = 0;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
 void SetupRC(void)
 {
     glewInit();
@@ -321,11 +1146,6 @@ void SetupRC(void)
     glEnable(GL_LIGHTING);
     glEnable(GL_LIGHT0);
 
-    GLfloat ambientLight[]  = { 0.2f, 0.2f, 0.2f, 1.0f };
-    GLfloat diffuseLight[]  = { 0.8f, 0.8f, 0.8f, 1.0f };
-    GLfloat specularLight[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    GLfloat lightPos[]      = { 400.0f, 400.0f, 200.0f, 0.0f }; // positional light
-
     glLightfv(GL_LIGHT0, GL_AMBIENT, ambientLight);
     glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuseLight);
     glLightfv(GL_LIGHT0, GL_SPECULAR, specularLight);
@@ -336,9 +1156,8 @@ void SetupRC(void)
     glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
 
     // Set default specular and shininess
-    GLfloat matSpecular[] = { 0.8f, 0.8f, 0.8f, 1.0f };
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, matSpecular);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 50.0f);
+    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, matShininess);
 
     // calculate shadow projection matrix
     M3DVector4f planeEq;
@@ -369,25 +1188,27 @@ void SetupRC(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // vbo setup
-    if (!glIsBuffer(gVboLinks[0]))
-    {
-        glGenBuffers(NUM_LINKS, gVboLinks);
-        glGenBuffers(NUM_LINKS, gVboNormals);
-    }
-    for (int i = 0; i < NUM_LINKS; ++i)
-    {
-        glBindBuffer(GL_ARRAY_BUFFER, gVboLinks[i]);
-        glBufferData(GL_ARRAY_BUFFER, numTriangles[i] * sizeof(float) * 9, links[i], GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, gVboNormals[i]);
-        glBufferData(GL_ARRAY_BUFFER, numTriangles[i] * sizeof(float) * 3, normals[i], GL_STATIC_DRAW);
-    }
+    SetupShadowMap();
+    SetupLinkBuffers();
+    SetupShaders();
+
+    // first slice right away, the rest from the timer
+    glGenBuffers(1, &gVboEnvelope);
+    if (initWorkspaceSampler(&workspaceSampler, clawLength, WORKSPACE_VOXEL_SIZE, WORKSPACE_MAX_STEPS))
+        RefineWorkspace(0);
 }
 
-void TimerFunction(int value)
+// Same matrix glOrtho multiplies onto the stack
+void MakeOrthographicMatrix(M3DMatrix44f m, GLfloat left, GLfloat right, GLfloat bottom, GLfloat top,
+                            GLfloat zNear, GLfloat zFar)
 {
-    glutPostRedisplay();
-    glutTimerFunc(1, TimerFunction, 1);
+    m3dLoadIdentity44(m);
+    m[0] = 2.0f / (right - left);
+    m[5] = 2.0f / (top - bottom);
+    m[10] = -2.0f / (zFar - zNear);
+    m[12] = -(right + left) / (right - left);
+    m[13] = -(top + bottom) / (top - bottom);
+    m[14] = -(zFar + zNear) / (zFar - zNear);
 }
 
 void ChangeSize(int w, int h)
@@ -406,14 +1227,152 @@ void ChangeSize(int w, int h)
         windowWidth  = 100.0f;
         windowHeight = 100.0f / aspect;
         glOrtho(-100.0, 100.0, -windowHeight, windowHeight, -1000.0, 1000.0);
+        MakeOrthographicMatrix(projectionMatrix, -100.0f, 100.0f, -windowHeight, windowHeight, -1000.0f, 1000.0f);
     }
     else
     {
         windowWidth  = 100.0f * aspect;
         windowHeight = 100.0f;
         glOrtho(-windowWidth, windowWidth, -100.0, 100.0, -1000.0, 1000.0);
+        MakeOrthographicMatrix(projectionMatrix, -windowWidth, windowWidth, -100.0f, 100.0f, -1000.0f, 1000.0f);
     }
     glMatrixMode(GL_MODELVIEW);
+    glutPostRedisplay();
+}
+
+// Distance from the sphere center to the closest link surface with the
+// joints at angles
+float GetSphereDistance(const GLfloat angles[NUM_LINKS])
+{
+    struct KinematicChain chain;
+    initKinematicChain(&chain);
+    for (int j = 0; j < NUM_LINKS; ++j)
+        setJointAngle(&chain, j, angles[j]);
+    struct ArmContact contact;
+    if (!findArmSphereContact(linkBVHs, &chain, sphereCenter, INFINITY, &contact))
+        return INFINITY;
+    return contact.distance;
+}
+
+// Turn one joint of the interactive arm, keeping the angle in [0, 360).
+// Only that link and the ones after it are recomputed.
+void RotateJoint(int joint, GLfloat degrees)
+{
+    GLfloat previousAngle = armChain.jointAngles[joint];
+    bool wasColliding = checkSelfCollision(linkBVHs, linkBoxes, &selfCollisionPairs, &armChain, &armSelfCollision);
+
+    // stop at the target sphere instead of stepping through it
+    GLfloat fromAngles[NUM_LINKS], toAngles[NUM_LINKS];
+    memcpy(fromAngles, armChain.jointAngles, sizeof(fromAngles));
+    memcpy(toAngles, armChain.jointAngles, sizeof(toAngles));
+    toAngles[joint] += degrees;
+    float impactTime;
+    struct ArmContact contact;
+    if (findFirstSphereImpact(linkBVHs, fromAngles, toAngles, sphereCenter, sphereRadius, CCD_TOLERANCE,
+                              &impactTime, &contact))
+    {
+        if (impactTime > 0.0f)
+        {
+            printf("Link %d reaches the sphere after %.2f of %.2f degrees\n", contact.link + 1,
+                   impactTime * degrees, degrees);
+            degrees *= impactTime;
+        }
+        else
+        {
+            // already touching: only moves that open the gap are allowed.
+            // Probe in small steps until clear of the tolerance, then check
+            // the rest of the move continuously.
+            GLfloat angles[NUM_LINKS];
+            memcpy(angles, fromAngles, sizeof(angles));
+            float t = 0.0f;
+            float distance = GetSphereDistance(angles);
+            while (distance - sphereRadius <= CCD_TOLERANCE && t < 1.0f)
+            {
+                t = fminf(t + 1.0f / CCD_SEPARATION_STEPS, 1.0f);
+                angles[joint] = fromAngles[joint] + t * degrees;
+                float next = GetSphereDistance(angles);
+                if (next <= distance)
+                {
+                    printf("Link %d touches the sphere, the move would not clear it\n", contact.link + 1);
+                    return;
+                }
+                distance = next;
+            }
+            if (t < 1.0f && findFirstSphereImpact(linkBVHs, angles, toAngles, sphereCenter, sphereRadius,
+                                                  CCD_TOLERANCE, &impactTime, &contact))
+                degrees *= t + (1.0f - t) * impactTime;
+        }
+    }
+
+    GLfloat angle = previousAngle + degrees;
+    if (angle >= 360)
+        angle -= 360;
+    else if (angle < 0)
+        angle += 360;
+    setJointAngle(&armChain, joint, angle);
+    ikActive = false;
+    trajectoryActive = false;
+
+    // refuse moves into self-collision, moves out of it are fine
+    if (!wasColliding && checkSelfCollision(linkBVHs, linkBoxes, &selfCollisionPairs, &armChain, &armSelfCollision))
+    {
+        printf("Link %d would hit link %d\n", armSelfCollision.links[1] + 1, armSelfCollision.links[0] + 1);
+        setJointAngle(&armChain, joint, previousAngle);
+    }
+}
+
+// Move the target sphere to a random reachable claw position that keeps it
+// above the ground. Uses the reachability map when one is loaded, otherwise
+// whatever part of the workspace has been sampled so far.
+void PlaceTargetSphere(void)
+{
+    GLfloat lo[3], hi[3];
+    if (reachabilityMapLoaded)
+    {
+        const struct ReachabilityMapHeader* header = reachabilityMap.header;
+        for (int k = 0; k < 3; ++k)
+        {
+            lo[k] = header->origin[k] * header->voxelSize;
+            hi[k] = lo[k] + header->bricks[k] * REACHMAP_BRICK_SIZE * header->voxelSize;
+        }
+    }
+    else
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            lo[k] = -radius;
+            hi[k] = radius;
+        }
+    }
+    lo[1] = fmaxf(lo[1], groundPoints[0][1] + sphereRadius);
+
+    for (int i = 0; i < PLACE_SPHERE_TRIES; ++i)
+    {
+        GLfloat p[3];
+        for (int k = 0; k < 3; ++k)
+            p[k] = lo[k] + (hi[k] - lo[k]) * ((GLfloat)rand() / RAND_MAX);
+        int reachable = reachabilityMapLoaded ? isReachable(&reachabilityMap, p)
+                                              : isWorkspaceVoxelOccupied(&workspaceSampler, p);
+        if (reachable)
+        {
+            m3dCopyVector3(sphereCenter, p);
+            return;
+        }
+    }
+    printf("No reachable position found for the target sphere\n");
+}
+
+// Print the clearance between the arm and the target sphere
+void PrintSphereClearance(void)
+{
+    int link = -1;
+    float clearance = getArmSphereDistance(linkSDFs, &armChain, sphereCenter, sphereRadius, &link);
+    if (link < 0)
+        return;
+    if (clearance < 0.0f)
+        printf("Sphere overlaps link %d by %.2f\n", link + 1, -clearance);
+    else
+        printf("Sphere clearance %.2f to link %d\n", clearance, link + 1);
 }
 
 void HandleKey(unsigned char key, int x, int y)
@@ -422,71 +1381,226 @@ void HandleKey(unsigned char key, int x, int y)
     switch (key)
     {
         case 'q': case 'Q':
-            linkRotate[1] -= rotateStep;
+            RotateJoint(1, -rotateStep);
             break;
         case 'a': case 'A':
-            linkRotate[1] += rotateStep;
+            RotateJoint(1, rotateStep);
             break;
         case 'w': case 'W':
-            linkRotate[2] += rotateStep;
+            RotateJoint(2, rotateStep);
             break;
         case 's': case 'S':
-            linkRotate[2] -= rotateStep;
+            RotateJoint(2, -rotateStep);
             break;
         case 'e': case 'E':
-            linkRotate[3] += rotateStep;
+            RotateJoint(3, rotateStep);
             break;
         case 'd': case 'D':
-            linkRotate[3] -= rotateStep;
+            RotateJoint(3, -rotateStep);
             break;
         case 'r': case 'R':
-            linkRotate[4] -= rotateStep;
+            RotateJoint(4, -rotateStep);
             break;
         case 'f': case 'F':
-            linkRotate[4] += rotateStep;
+            RotateJoint(4, rotateStep);
+            break;
+        case 'n': case 'N':
+            // toggle smooth / faceted normals of the indexed meshes
+            meshNormalMode = (meshNormalMode == SmoothNormals) ? FacetedNormals : SmoothNormals;
+            BuildLinkMeshes();
+            SetupLinkBuffers();
+            break;
+        case 'i': case 'I':
+            StartArmIK(sphereCenter);
+            break;
+        case 'p': case 'P':
+            PlaceTargetSphere();
+            break;
+        case 'c': case 'C':
+            PrintSphereClearance();
+            break;
+        case 't': case 'T':
+            ToggleTrajectory();
+            break;
+        case 'b': case 'B':
+            // redraw continuously and show the frame rate
+            benchmarkMode = !benchmarkMode;
+            if (!benchmarkMode)
+                glutSetWindowTitle("Robot Arm");
             break;
     }
-    for (int i = 1; i < NUM_LINKS; ++i)
+    shadowMapDirty = true;
+    glutPostRedisplay();
+}
+
+// Left click: move the claw tip to the clicked surface point. The depth of
+// the last frame gives the point; the background is ignored.
+void HandleMouse(int button, int state, int x, int y)
+{
+    if (button != GLUT_LEFT_BUTTON || state != GLUT_DOWN || currentDrawMode == Instanced)
+        return;
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLfloat depth;
+    GLint windowY = viewport[3] - 1 - y;
+    glReadPixels(x, windowY, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth);
+    if (depth >= 1.0f)
+        return;
+
+    GLdouble modelview[16], projection[16], point[3];
+    for (int i = 0; i < 16; ++i)
     {
-        if (linkRotate[i] >= 360)
-            linkRotate[i] -= 360;
-        else if (linkRotate[i] < 0)
-            linkRotate[i] += 360;
+        modelview[i] = sceneViewMatrix[i];
+        projection[i] = projectionMatrix[i];
     }
-    glutPostRedisplay();
+    if (!gluUnProject(x, windowY, depth, modelview, projection, viewport, &point[0], &point[1], &point[2]))
+        return;
+    GLfloat target[3] = { (GLfloat)point[0], (GLfloat)point[1], (GLfloat)point[2] };
+    StartArmIK(target);
 }
 
 void ProcessMenu(int value)
 {
+    if (value == Shader && gPhongProgram == 0)
+        return;
+    if (value == Instanced && gInstancedProgram == 0)
+        return;
     currentDrawMode = (DrawMode)value;
+    shadowMapDirty = true;
     glutPostRedisplay();
 }
 
+void ProcessArmCountMenu(int value)
+{
+    numArms = value;
+    shadowMapDirty = true;
+    glutPostRedisplay();
+}
+
+void ProcessShadowMenu(int value)
+{
+    if (value == ShadowMapShadow && gShadowFbo == 0)
+        return;
+    currentShadowMode = (ShadowMode)value;
+    shadowMapDirty = true;
+    glutPostRedisplay();
+}
+
+// Sample the whole workspace at the finest level and save it as a
+// reachability map. Returns the process exit code.
+int BuildReachabilityMap(const char* filename)
+{
+    struct WorkspaceSampler sampler;
+    if (!initWorkspaceSampler(&sampler, clawLength, WORKSPACE_VOXEL_SIZE, WORKSPACE_MAX_STEPS))
+        return 1;
+    CStopWatch timer;
+    // a slice returning 1 only means it found voxels, sample until done
+    while (!sampler.done)
+    {
+        if (stepWorkspaceSampler(&sampler, 1.0) < 0)
+        {
+            freeWorkspaceSampler(&sampler);
+            return 1;
+        }
+    }
+    printf("Sampled %llu configurations into %u voxels in %.2f s\n",
+           (unsigned long long)sampler.numSamples, sampler.numVoxels, timer.GetElapsedSeconds());
+    int ok = saveReachabilityMap(&sampler, filename);
+    freeWorkspaceSampler(&sampler);
+    return ok ? 0 : 1;
+}
+
+// Replay a trajectory headless, as fast as possible, checking every tick
+// for self-collision and contact with the target sphere. Returns the
+// process exit code.
+int SimulateTrajectory(const char* filename)
+{
+    if (!loadTrajectory(filename, &trajectory))
+        return 1;
+    struct KinematicChain chain;
+    struct SelfCollisionState selfCollision;
+    memset(&selfCollision, 0, sizeof(selfCollision));
+    initKinematicChain(&chain);
+    initTrajectoryPlayer(&trajectoryPlayer, &trajectory, TRAJECTORY_TICK_SECONDS);
+
+    uint64_t collisionTicks = 0, contactTicks = 0;
+    bool wasColliding = false, wasTouching = false;
+    CStopWatch timer;
+    while (!trajectoryPlayer.done)
+    {
+        stepTrajectoryPlayer(&trajectoryPlayer, &chain);
+        double time = getTrajectoryPlayerTime(&trajectoryPlayer);
+
+        bool colliding = checkSelfCollision(linkBVHs, linkBoxes, &selfCollisionPairs, &chain, &selfCollision);
+        if (colliding && !wasColliding)
+            printf("%.3f s: link %d hits link %d\n", time, selfCollision.links[1] + 1, selfCollision.links[0] + 1);
+        collisionTicks += colliding;
+        wasColliding = colliding;
+
+        int link;
+        bool touching = getArmSphereDistance(linkSDFs, &chain, sphereCenter, sphereRadius, &link) <= 0.0f;
+        if (touching && !wasTouching)
+            printf("%.3f s: link %d touches the sphere\n", time, link + 1);
+        contactTicks += touching;
+        wasTouching = touching;
+    }
+    double seconds = timer.GetElapsedSeconds();
+    double duration = getTrajectoryPlayerTime(&trajectoryPlayer);
+    printf("Simulated %.3f s (%llu ticks) in %.3f s, %.0fx real time\n", duration,
+           (unsigned long long)trajectoryPlayer.tick, seconds, seconds > 0.0 ? duration / seconds : 0.0);
+    printf("Self-collision during %llu ticks, sphere contact during %llu ticks\n",
+           (unsigned long long)collisionTicks, (unsigned long long)contactTicks);
+    freeTrajectory(&trajectory);
+    return 0;
+}
+
 void loadSTL()
 {
     for (int i = 0; i < NUM_LINKS; ++i)
     {
         char filename[256];
         snprintf(filename, sizeof(filename), "%s%d.stl", LINKS_FILE_PREFIX, i + 1);
-        numTriangles[i] = readBinSTL(filename, &links[i], &normals[i]);
+        numTriangles[i] = mapSTL(filename, &linkMappings[i]);
         printf("Loaded %s with %d triangles\n", filename, numTriangles[i]);
+        buildMeshBVH(&linkMappings[i], &linkBVHs[i]);
+        computeMeshOBB(&linkBVHs[i], &linkBoxes[i]);
+        if (buildLinkSDF(&linkBVHs[i], SDF_CELL_SIZE, &linkSDFs[i]))
+            printf("Distance field of link %d: %u of %u bricks refined\n", i + 1, linkSDFs[i].numFineBricks,
+                   linkSDFs[i].bricks[0] * linkSDFs[i].bricks[1] * linkSDFs[i].bricks[2]);
     }
+    findSelfCollisionPairs(linkBVHs, linkBoxes, &selfCollisionPairs);
+    printf("Checking %d link pairs for self-collision\n", selfCollisionPairs.numPairs);
+    BuildLinkMeshes();
 }
 
 void ShutdownRC(void)
 {
     glDeleteTextures(NUM_TEXTURES, textureIDs);
+    glDeleteTextures(1, &gShadowTexture);
+    glDeleteFramebuffers(1, &gShadowFbo);
+    gltDeleteSphereBatches();
+    glDeleteBuffers(1, &gVboEnvelope);
+    freeWorkspaceSampler(&workspaceSampler);
+    if (reachabilityMapLoaded)
+        unmapReachabilityMap(&reachabilityMap);
     for (int i = 0; i < NUM_LINKS; ++i)
     {
-        if (links[i] != NULL)
-        {
-            free(links[i]);
-        }
+        unmapBinSTL(&linkMappings[i]);
+        freeIndexedMesh(&linkMeshes[i]);
+        freeMeshBVH(&linkBVHs[i]);
+        freeLinkSDF(&linkSDFs[i]);
     }
+    freeTrajectory(&trajectory);
+    free(armInstances);
+    free(instanceMatrices);
 }
 
 int main(int argc, char *argv[])
 {
+    // the SIMD kernels must match the scalar math3d bit for bit
+    m3dCheckKernels(MATH3D_CHECK_MATRICES);
+    printf("math3d kernels: %s\n", m3dGetKernelName());
+    initKinematicChain(&armChain);
     loadSTL();
     // calculate radius
     // from root to claw origin
@@ -500,9 +1614,9 @@ int main(int argc, char *argv[])
     GLfloat minY = INFINITY;
     for (uint32_t j = 0; j < numTriangles[4]; ++j)
     {
-        GLfloat v1y = links[4][j * 9 + 1];
-        GLfloat v2y = links[4][j * 9 + 4];
-        GLfloat v3y = links[4][j * 9 + 7];
+        GLfloat v1y = stlFacetVertex(&linkMappings[4], j, 0)[1];
+        GLfloat v2y = stlFacetVertex(&linkMappings[4], j, 1)[1];
+        GLfloat v3y = stlFacetVertex(&linkMappings[4], j, 2)[1];
         GLfloat vMaxY = fmaxf(v1y, fmaxf(v2y, v3y));
         GLfloat vMinY = fminf(v1y, fminf(v2y, v3y));
         if (vMaxY > maxY) maxY = vMaxY;
@@ -510,9 +1624,34 @@ int main(int argc, char *argv[])
     }
     clawLength = maxY - minY;
     radius += clawLength;
-    printf("Calculated workspace radius: %.2f\n", radius);
+    printf("Workspace bounding radius: %.2f\n", radius);
+
+    // offline stage, no window needed
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--build-reachability") == 0)
+            return BuildReachabilityMap(i + 1 < argc ? argv[i + 1] : REACHABILITY_FILE);
+        if (strcmp(argv[i], "--simulate") == 0 && i + 1 < argc)
+            return SimulateTrajectory(argv[i + 1]);
+    }
+    reachabilityMapLoaded = mapReachabilityMap(REACHABILITY_FILE, getArmHash(clawLength, WORKSPACE_VOXEL_SIZE),
+                                               &reachabilityMap);
+    if (!reachabilityMapLoaded)
+        printf("No reachability map, run with --build-reachability to create %s\n", REACHABILITY_FILE);
 
     glutInit(&argc, argv);
+    // glutInit removed its own options
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--benchmark") == 0)
+            benchmarkMode = true;
+        if (strcmp(argv[i], "--trajectory") == 0 && i + 1 < argc &&
+            loadTrajectory(argv[i + 1], &trajectory))
+        {
+            printf("Loaded trajectory %s, %.3f s, press T to play\n", argv[i + 1], getTrajectoryDuration(&trajectory));
+            initTrajectoryPlayer(&trajectoryPlayer, &trajectory, TRAJECTORY_TICK_SECONDS);
+        }
+    }
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
     glutInitWindowSize(800, 600);
     glutCreateWindow("Robot Arm");
@@ -520,15 +1659,31 @@ int main(int argc, char *argv[])
     glutDisplayFunc(RenderScene);
     glutReshapeFunc(ChangeSize);
     glutKeyboardFunc(HandleKey);
+    glutMouseFunc(HandleMouse);
+
+    int armCountMenu = glutCreateMenu(ProcessArmCountMenu);
+    glutAddMenuEntry("1", 1);
+    glutAddMenuEntry("10", 10);
+    glutAddMenuEntry("100", 100);
+    glutAddMenuEntry("1000", 1000);
+    glutAddMenuEntry("10000", MAX_ARMS);
+
+    int shadowMenu = glutCreateMenu(ProcessShadowMenu);
+    glutAddMenuEntry("Planar Projection", PlanarShadow);
+    glutAddMenuEntry("Shadow Map", ShadowMapShadow);
 
     glutCreateMenu(ProcessMenu);
     glutAddMenuEntry("Immediate Mode", Default);
     glutAddMenuEntry("Vertex Array", VertexArray);
     glutAddMenuEntry("VBO", VBO);
+    glutAddMenuEntry("VBO + VAO", VAO);
+    glutAddMenuEntry("Shader (Per-Pixel Lighting)", Shader);
+    glutAddMenuEntry("Instanced Arms", Instanced);
+    glutAddSubMenu("Number of Arms", armCountMenu);
+    glutAddSubMenu("Shadows", shadowMenu);
     glutAttachMenu(GLUT_RIGHT_BUTTON);
 
     SetupRC();
-    glutTimerFunc(1, TimerFunction, 1);
     glutMainLoop();
     ShutdownRC();
     return 0;
@@ -0,0 +1,294 @@
+#include "sdf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Grid margin around the mesh, in cells
+#define SDF_MARGIN 2
+
+static const float SDF_RAY_OFFSET[3] = { 1.37e-3f, 2.71e-3f, 3.14e-3f };
+
+// bound is an upper limit on the distance, it only prunes the BVH search
+static float sampleSignedDistance(const struct MeshBVH* bvh, const float p[3], float bound)
+{
+    uint32_t facet;
+    float distance;
+    M3DVector3f point;
+    if (!findClosestFacet(bvh, p, bound, &facet, &distance, point))
+        return INFINITY;
+    // grid points tend to line up with CAD vertices and edges, start the rays
+    // slightly off the sample so they rarely pass exactly through one
+    M3DVector3f origin = { p[0] + SDF_RAY_OFFSET[0], p[1] + SDF_RAY_OFFSET[1], p[2] + SDF_RAY_OFFSET[2] };
+    int inside = 0;
+    for (int axis = 0; axis < 3; ++axis)
+        inside += countRayCrossings(bvh, origin, axis) & 1;
+    return inside >= 2 ? -distance : distance;
+}
+
+static inline size_t getCoarseIndex(const struct LinkSDF* sdf, uint32_t x, uint32_t y, uint32_t z)
+{
+    return ((size_t)z * (sdf->bricks[1] + 1) + y) * (sdf->bricks[0] + 1) + x;
+}
+
+int buildLinkSDF(const struct MeshBVH* bvh, float cellSize, struct LinkSDF* sdf)
+{
+    memset(sdf, 0, sizeof(*sdf));
+    if (bvh->numNodes == 0)
+        return 0;
+
+    const struct BVHNode* root = &bvh->nodes[0];
+    float brickSize = cellSize * SDF_BRICK_CELLS;
+    sdf->cellSize = cellSize;
+    sdf->inverseCellSize = 1.0f / cellSize;
+    size_t numBricks = 1, numCoarse = 1;
+    for (int k = 0; k < 3; ++k)
+    {
+        sdf->origin[k] = root->boundsMin[k] - SDF_MARGIN * cellSize;
+        float extent = root->boundsMax[k] + SDF_MARGIN * cellSize - sdf->origin[k];
+        sdf->bricks[k] = (uint32_t)ceilf(extent / brickSize);
+        numBricks *= sdf->bricks[k];
+        numCoarse *= sdf->bricks[k] + 1;
+    }
+    sdf->coarse = (float*)malloc(numCoarse * sizeof(float));
+    sdf->brickIndex = (uint32_t*)malloc(numBricks * sizeof(uint32_t));
+    if (!sdf->coarse || !sdf->brickIndex)
+    {
+        perror("Failed to allocate memory");
+        freeLinkSDF(sdf);
+        return 0;
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < (int64_t)numCoarse; ++i)
+    {
+        uint32_t x = (uint32_t)(i % (sdf->bricks[0] + 1));
+        uint32_t y = (uint32_t)(i / (sdf->bricks[0] + 1) % (sdf->bricks[1] + 1));
+        uint32_t z = (uint32_t)(i / (sdf->bricks[0] + 1) / (sdf->bricks[1] + 1));
+        float p[3] = { sdf->origin[0] + x * brickSize, sdf->origin[1] + y * brickSize,
+                       sdf->origin[2] + z * brickSize };
+        sdf->coarse[i] = sampleSignedDistance(bvh, p, INFINITY);
+    }
+
+    // a surface point inside the brick is within half the diagonal of the
+    // nearest corner and within the diagonal of all of them
+    float diagonal = brickSize * sqrtf(3.0f);
+    uint32_t numFine = 0;
+    for (uint32_t z = 0; z < sdf->bricks[2]; ++z)
+    {
+        for (uint32_t y = 0; y < sdf->bricks[1]; ++y)
+        {
+            for (uint32_t x = 0; x < sdf->bricks[0]; ++x)
+            {
+                float nearest = INFINITY, farthest = 0.0f;
+                for (int c = 0; c < 8; ++c)
+                {
+                    float d = fabsf(sdf->coarse[getCoarseIndex(sdf, x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2))]);
+                    nearest = fminf(nearest, d);
+                    farthest = fmaxf(farthest, d);
+                }
+                bool nearSurface = nearest <= 0.5f * diagonal && farthest <= diagonal;
+                size_t brick = ((size_t)z * sdf->bricks[1] + y) * sdf->bricks[0] + x;
+                sdf->brickIndex[brick] = nearSurface ? numFine++ : SDF_NO_BRICK;
+            }
+        }
+    }
+
+    const size_t samplesPerBrick = SDF_BRICK_SAMPLES * SDF_BRICK_SAMPLES * SDF_BRICK_SAMPLES;
+    sdf->numFineBricks = numFine;
+    sdf->fine = (float*)malloc((size_t)numFine * samplesPerBrick * sizeof(float) + 1);
+    if (!sdf->fine)
+    {
+        perror("Failed to allocate memory");
+        freeLinkSDF(sdf);
+        return 0;
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t brick = 0; brick < (int64_t)numBricks; ++brick)
+    {
+        uint32_t index = sdf->brickIndex[brick];
+        if (index == SDF_NO_BRICK)
+            continue;
+        uint32_t bx = (uint32_t)(brick % sdf->bricks[0]);
+        uint32_t by = (uint32_t)(brick / sdf->bricks[0] % sdf->bricks[1]);
+        uint32_t bz = (uint32_t)(brick / sdf->bricks[0] / sdf->bricks[1]);
+        float* samples = &sdf->fine[(size_t)index * samplesPerBrick];
+        // the corner distance plus the way to the sample bounds every sample
+        float cornerDistance = fabsf(sdf->coarse[getCoarseIndex(sdf, bx, by, bz)]);
+        for (int z = 0; z < SDF_BRICK_SAMPLES; ++z)
+        {
+            for (int y = 0; y < SDF_BRICK_SAMPLES; ++y)
+            {
+                for (int x = 0; x < SDF_BRICK_SAMPLES; ++x)
+                {
+                    float p[3] = { sdf->origin[0] + (bx * SDF_BRICK_CELLS + x) * cellSize,
+                                   sdf->origin[1] + (by * SDF_BRICK_CELLS + y) * cellSize,
+                                   sdf->origin[2] + (bz * SDF_BRICK_CELLS + z) * cellSize };
+                    float bound = cornerDistance + sqrtf((float)(x * x + y * y + z * z)) * cellSize * 1.001f + cellSize;
+                    samples[(z * SDF_BRICK_SAMPLES + y) * SDF_BRICK_SAMPLES + x] = sampleSignedDistance(bvh, p, bound);
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+void freeLinkSDF(struct LinkSDF* sdf)
+{
+    free(sdf->coarse);
+    free(sdf->brickIndex);
+    free(sdf->fine);
+    memset(sdf, 0, sizeof(*sdf));
+}
+
+static inline float lerp(float a, float b, float t)
+{
+    return a + (b - a) * t;
+}
+
+// c holds the 8 corners, x fastest
+static inline float trilinear(const float c[8], float fx, float fy, float fz)
+{
+    return lerp(lerp(lerp(c[0], c[1], fx), lerp(c[2], c[3], fx), fy),
+                lerp(lerp(c[4], c[5], fx), lerp(c[6], c[7], fx), fy), fz);
+}
+
+float getSDFDistance(const struct LinkSDF* sdf, const float p[3])
+{
+    // clamp into the grid, remembering how far we moved
+    float cell[3], outside2 = 0.0f;
+    for (int k = 0; k < 3; ++k)
+    {
+        float limit = (float)(sdf->bricks[k] * SDF_BRICK_CELLS);
+        float c = (p[k] - sdf->origin[k]) * sdf->inverseCellSize;
+        float clamped = c < 0.0f ? 0.0f : (c > limit ? limit : c);
+        outside2 += (c - clamped) * (c - clamped);
+        cell[k] = clamped;
+    }
+
+    int brick[3];
+    float local[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        brick[k] = (int)(cell[k] * (1.0f / SDF_BRICK_CELLS));
+        if (brick[k] >= (int)sdf->bricks[k])
+            brick[k] = sdf->bricks[k] - 1;
+        local[k] = cell[k] - brick[k] * SDF_BRICK_CELLS;
+    }
+    uint32_t index = sdf->brickIndex[((size_t)brick[2] * sdf->bricks[1] + brick[1]) * sdf->bricks[0] + brick[0]];
+
+    float corners[8], distance;
+    if (index != SDF_NO_BRICK)
+    {
+        int i[3];
+        float f[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            i[k] = (int)local[k];
+            if (i[k] >= SDF_BRICK_CELLS)
+                i[k] = SDF_BRICK_CELLS - 1;
+            f[k] = local[k] - i[k];
+        }
+        const float* samples = &sdf->fine[(size_t)index * SDF_BRICK_SAMPLES * SDF_BRICK_SAMPLES * SDF_BRICK_SAMPLES];
+        for (int c = 0; c < 8; ++c)
+            corners[c] = samples[((i[2] + (c >> 2)) * SDF_BRICK_SAMPLES + i[1] + ((c >> 1) & 1)) * SDF_BRICK_SAMPLES +
+                                 i[0] + (c & 1)];
+        distance = trilinear(corners, f[0], f[1], f[2]);
+    }
+    else
+    {
+        for (int c = 0; c < 8; ++c)
+            corners[c] = sdf->coarse[getCoarseIndex(sdf, brick[0] + (c & 1), brick[1] + ((c >> 1) & 1),
+                                                    brick[2] + (c >> 2))];
+        distance = trilinear(corners, local[0] * (1.0f / SDF_BRICK_CELLS), local[1] * (1.0f / SDF_BRICK_CELLS),
+                             local[2] * (1.0f / SDF_BRICK_CELLS));
+    }
+
+    if (outside2 == 0.0f)
+        return distance;
+    float outside = sqrtf(outside2) * sdf->cellSize;
+    return fmaxf(outside, distance - outside);
+}
+
+float getArmPointDistance(const struct LinkSDF sdfs[NUM_LINKS], struct KinematicChain* chain, const float p[3],
+                          int* link)
+{
+    updateKinematicChain(chain);
+    float best = INFINITY;
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        if (!sdfs[i].coarse)
+            continue;
+        M3DVector3f local;
+        m3dInverseTransformVector3(local, p, chain->linkMatrices[i]);
+        float distance = getSDFDistance(&sdfs[i], local);
+        if (distance < best)
+        {
+            best = distance;
+            if (link)
+                *link = i;
+        }
+    }
+    return best;
+}
+
+float getArmSphereDistance(const struct LinkSDF sdfs[NUM_LINKS], struct KinematicChain* chain,
+                           const float center[3], float radius, int* link)
+{
+    return getArmPointDistance(sdfs, chain, center, link) - radius;
+}
+
+float getArmCapsuleDistance(const struct LinkSDF sdfs[NUM_LINKS], struct KinematicChain* chain, const float a[3],
+                            const float b[3], float radius, int* link)
+{
+    updateKinematicChain(chain);
+    float best = INFINITY;
+    for (int i = 0; i < NUM_LINKS; ++i)
+    {
+        if (!sdfs[i].coarse)
+            continue;
+        M3DVector3f localA, localB, segment;
+        m3dInverseTransformVector3(localA, a, chain->linkMatrices[i]);
+        m3dInverseTransformVector3(localB, b, chain->linkMatrices[i]);
+        m3dSubtractVectors3(segment, localB, localA);
+        float length = m3dGetVectorLength(segment);
+
+        // the field changes by at most the distance moved, so nothing closer
+        // than the best distance so far hides in the next distance - best of
+        // the segment. The minimum step keeps the lookup count bounded.
+        float minStep = length / SDF_CAPSULE_STEPS;
+        float s = 0.0f;
+        for (int step = 0; step <= SDF_CAPSULE_STEPS; ++step)
+        {
+            float t = length > 0.0f ? fminf(s / length, 1.0f) : 0.0f;
+            M3DVector3f p;
+            for (int k = 0; k < 3; ++k)
+                p[k] = localA[k] + segment[k] * t;
+            float distance = getSDFDistance(&sdfs[i], p);
+            if (distance < best)
+            {
+                best = distance;
+                if (link)
+                    *link = i;
+            }
+            if (t >= 1.0f)
+                break;
+            s += fmaxf(distance - best, minStep);
+        }
+    }
+    return best - radius;
+}
+
+void getArmPointDistances(const struct LinkSDF sdfs[NUM_LINKS], struct KinematicChain* chain,
+                          const float* const points[3], size_t count, float* distances)
+{
+    // shared chain, bring it up to date before the threads read it
+    updateKinematicChain(chain);
+    #pragma omp parallel for schedule(static) if (count > 1024)
+    for (int64_t i = 0; i < (int64_t)count; ++i)
+    {
+        float p[3] = { points[0][i], points[1][i], points[2][i] };
+        distances[i] = getArmPointDistance(sdfs, chain, p, NULL);
+    }
+}
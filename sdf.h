@@ -0,0 +1,59 @@
+#ifndef SDF_H
+#define SDF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bvh.h"
+#include "kinematics.h"
+
+// Sparse signed distance field of one link in its own frame, negative
+// inside. A coarse grid holds the distance at every brick corner; bricks
+// near the surface also get a fine grid of (SDF_BRICK_CELLS + 1)^3 samples,
+// so a lookup never needs a neighbouring brick.
+#define SDF_BRICK_CELLS 8
+#define SDF_BRICK_SAMPLES (SDF_BRICK_CELLS + 1)
+#define SDF_NO_BRICK 0xFFFFFFFFu
+
+struct LinkSDF
+{
+    float origin[3];            // corner of brick 0
+    float cellSize;
+    float inverseCellSize;
+    uint32_t bricks[3];
+    float* coarse;              // (bricks + 1)^3 corner distances, x fastest
+    uint32_t* brickIndex;       // per brick, SDF_NO_BRICK away from the surface
+    uint32_t numFineBricks;
+    float* fine;                // SDF_BRICK_SAMPLES^3 per fine brick, x fastest
+};
+
+// Samples the mesh with the BVH: unsigned distance from findClosestFacet,
+// sign from the parity of ray crossings (majority of three axis rays, the
+// STL files are not guaranteed watertight). Parallel (OpenMP). Returns 0 on
+// failure.
+int buildLinkSDF(const struct MeshBVH* bvh, float cellSize, struct LinkSDF* sdf);
+void freeLinkSDF(struct LinkSDF* sdf);
+
+// Trilinear lookup, constant time. Outside the grid this is a lower bound:
+// the larger of the distance to the grid and the clamped lookup minus that
+// distance.
+float getSDFDistance(const struct LinkSDF* sdf, const float p[3]);
+
+// Distances against the posed arm (each query moved into every link frame).
+// link receives the closest link when not NULL. Negative means overlap.
+float getArmPointDistance(const struct LinkSDF sdfs[NUM_LINKS], struct KinematicChain* chain, const float p[3],
+                          int* link);
+float getArmSphereDistance(const struct LinkSDF sdfs[NUM_LINKS], struct KinematicChain* chain,
+                           const float center[3], float radius, int* link);
+// The segment is marched so that it skips only parts that cannot be closer
+// than the best distance found so far, with at most SDF_CAPSULE_STEPS + 1
+// lookups per link; the result is within half a segment / SDF_CAPSULE_STEPS
+// of the field minimum along the segment.
+#define SDF_CAPSULE_STEPS 16
+float getArmCapsuleDistance(const struct LinkSDF sdfs[NUM_LINKS], struct KinematicChain* chain, const float a[3],
+                            const float b[3], float radius, int* link);
+
+// count points, structure of arrays, in parallel (OpenMP)
+void getArmPointDistances(const struct LinkSDF sdfs[NUM_LINKS], struct KinematicChain* chain,
+                          const float* const points[3], size_t count, float* distances);
+
+#endif
@@ -0,0 +1,29 @@
+// instanced.vs
+// Many robot arms in one draw per link. Each instance brings its own
+// link to world matrix; lighting is done by phong.fs.
+#version 330
+
+layout(location = 0) in vec3 vPosition;
+layout(location = 1) in vec3 vNormal;
+layout(location = 2) in vec2 vTexCoord;
+layout(location = 3) in mat4 instanceMatrix;    // takes locations 3-6
+
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+
+uniform mat4 shadowMatrix;          // eye space to shadow map coordinates
+
+out vec3 eyeNormal;
+out vec2 texCoord;
+out vec4 shadowCoord;
+
+void main(void)
+{
+    mat4 mvMatrix = viewMatrix * instanceMatrix;
+    // rotation and uniform scale only, as in phong.vs
+    eyeNormal = mat3(mvMatrix) * vNormal;
+    texCoord = vTexCoord;
+    vec4 eyePosition = mvMatrix * vec4(vPosition, 1.0);
+    shadowCoord = shadowMatrix * eyePosition;
+    gl_Position = projectionMatrix * eyePosition;
+}
@@ -0,0 +1,56 @@
+// phong.fs
+// Same light and material as the fixed-function setup in SetupRC: one
+// directional light in eye space, color material for ambient and diffuse,
+// infinite viewer for the specular highlight. The texture modulates the
+// lit color so the lighting stays visible.
+#version 330
+
+uniform vec3 lightDirection;        // eye space, normalized
+uniform vec4 lightAmbient;
+uniform vec4 lightDiffuse;
+uniform vec4 lightSpecular;
+uniform vec4 lightModelAmbient;
+uniform vec4 materialSpecular;
+uniform float materialShininess;
+
+uniform vec4 color;
+uniform bool useLighting;
+uniform bool useTexture;
+uniform sampler2D colorMap;
+uniform bool useShadowMap;
+uniform sampler2DShadow shadowMap;
+
+in vec3 eyeNormal;
+in vec2 texCoord;
+in vec4 shadowCoord;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    vec4 base = color;
+    if (useTexture)
+        base *= texture(colorMap, texCoord);
+
+    if (!useLighting)
+    {
+        fragColor = base;
+        return;
+    }
+
+    // only the ambient term reaches surfaces in shadow
+    float visibility = 1.0;
+    if (useShadowMap)
+        visibility = textureProj(shadowMap, shadowCoord);
+
+    vec3 n = normalize(eyeNormal);
+    float diffuse = max(dot(n, lightDirection), 0.0) * visibility;
+    vec4 lit = (lightModelAmbient + lightAmbient) * base + diffuse * lightDiffuse * base;
+    if (diffuse > 0.0)
+    {
+        vec3 halfVector = normalize(lightDirection + vec3(0.0, 0.0, 1.0));
+        float specular = pow(max(dot(n, halfVector), 0.0), materialShininess);
+        lit += specular * visibility * lightSpecular * materialSpecular;
+    }
+    fragColor = vec4(lit.rgb, base.a);
+}
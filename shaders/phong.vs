@@ -0,0 +1,26 @@
+// phong.vs
+// Per-pixel lighting for the robot arm links. Matrices are built on the
+// CPU with math3d, one set per link.
+#version 330
+
+layout(location = 0) in vec3 vPosition;
+layout(location = 1) in vec3 vNormal;
+layout(location = 2) in vec2 vTexCoord;
+
+uniform mat4 mvMatrix;
+uniform mat4 mvpMatrix;
+
+uniform mat4 shadowMatrix;          // eye space to shadow map coordinates
+
+out vec3 eyeNormal;
+out vec2 texCoord;
+out vec4 shadowCoord;
+
+void main(void)
+{
+    // the modelview only has rotation and uniform scale
+    eyeNormal = mat3(mvMatrix) * vNormal;
+    texCoord = vTexCoord;
+    shadowCoord = shadowMatrix * (mvMatrix * vec4(vPosition, 1.0));
+    gl_Position = mvpMatrix * vec4(vPosition, 1.0);
+}
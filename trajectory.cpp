@@ -0,0 +1,218 @@
+#include "trajectory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRAJECTORY_LINE_LENGTH 512
+
+uint32_t loadTrajectory(const char* filename, struct Trajectory* trajectory)
+{
+    memset(trajectory, 0, sizeof(*trajectory));
+    FILE* file = fopen(filename, "r");
+    if (!file)
+    {
+        perror("Failed to open file");
+        return 0;
+    }
+
+    uint32_t capacity = 0;
+    uint32_t lineNumber = 0;
+    char line[TRAJECTORY_LINE_LENGTH];
+    while (fgets(line, sizeof(line), file))
+    {
+        ++lineNumber;
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+
+        struct TrajectoryWaypoint waypoint;
+        memset(&waypoint, 0, sizeof(waypoint));
+        char* end;
+        waypoint.time = strtod(p, &end);
+        bool valid = end != p;
+        for (int j = 1; j < NUM_LINKS && valid; ++j)
+        {
+            p = end;
+            waypoint.jointAngles[j] = strtof(p, &end);
+            valid = end != p;
+        }
+        if (valid && trajectory->numWaypoints > 0 &&
+            waypoint.time <= trajectory->waypoints[trajectory->numWaypoints - 1].time)
+        {
+            fprintf(stderr, "%s:%u: waypoint times must increase\n", filename, lineNumber);
+            valid = false;
+        }
+        else if (!valid)
+        {
+            fprintf(stderr, "%s:%u: expected time and %d joint angles\n", filename, lineNumber, NUM_LINKS - 1);
+        }
+        if (!valid)
+        {
+            fclose(file);
+            freeTrajectory(trajectory);
+            return 0;
+        }
+
+        if (trajectory->numWaypoints == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            struct TrajectoryWaypoint* waypoints = (struct TrajectoryWaypoint*)realloc(
+                trajectory->waypoints, capacity * sizeof(struct TrajectoryWaypoint));
+            if (!waypoints)
+            {
+                perror("Failed to allocate memory");
+                fclose(file);
+                freeTrajectory(trajectory);
+                return 0;
+            }
+            trajectory->waypoints = waypoints;
+        }
+        trajectory->waypoints[trajectory->numWaypoints++] = waypoint;
+    }
+    fclose(file);
+    if (trajectory->numWaypoints == 0)
+        fprintf(stderr, "No waypoints in %s\n", filename);
+    return trajectory->numWaypoints;
+}
+
+void freeTrajectory(struct Trajectory* trajectory)
+{
+    free(trajectory->waypoints);
+    memset(trajectory, 0, sizeof(*trajectory));
+}
+
+// Last segment starting at or before time, by binary search
+static uint32_t findSegment(const struct Trajectory* trajectory, double time)
+{
+    uint32_t lo = 0, hi = trajectory->numWaypoints - 1;
+    while (hi - lo > 1)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (trajectory->waypoints[mid].time <= time)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Catmull-Rom through waypoints segment and segment + 1 in power form, the
+// same spline as m3dCatmullRom3. The end waypoints are repeated.
+static void getSegmentCoefficients(const struct Trajectory* trajectory, uint32_t segment,
+                                   float coefficients[NUM_LINKS][4])
+{
+    uint32_t last = trajectory->numWaypoints - 1;
+    const float* p0 = trajectory->waypoints[segment > 0 ? segment - 1 : 0].jointAngles;
+    const float* p1 = trajectory->waypoints[segment].jointAngles;
+    const float* p2 = trajectory->waypoints[segment < last ? segment + 1 : last].jointAngles;
+    const float* p3 = trajectory->waypoints[segment + 2 <= last ? segment + 2 : last].jointAngles;
+    for (int j = 0; j < NUM_LINKS; ++j)
+    {
+        coefficients[j][0] = p1[j];
+        coefficients[j][1] = 0.5f * (p2[j] - p0[j]);
+        coefficients[j][2] = 0.5f * (2.0f * p0[j] - 5.0f * p1[j] + 4.0f * p2[j] - p3[j]);
+        coefficients[j][3] = 0.5f * (-p0[j] + 3.0f * p1[j] - 3.0f * p2[j] + p3[j]);
+    }
+}
+
+static inline void evaluateSegment(const float coefficients[NUM_LINKS][4], float t, float jointAngles[NUM_LINKS])
+{
+    for (int j = 0; j < NUM_LINKS; ++j)
+    {
+        const float* c = coefficients[j];
+        jointAngles[j] = c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+    }
+}
+
+static inline float getSegmentParameter(const struct Trajectory* trajectory, uint32_t segment, double time)
+{
+    if (segment + 1 >= trajectory->numWaypoints)
+        return 0.0f;
+    double start = trajectory->waypoints[segment].time;
+    double t = (time - start) / (trajectory->waypoints[segment + 1].time - start);
+    return (float)(t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t));
+}
+
+void sampleTrajectory(const struct Trajectory* trajectory, double time, float jointAngles[NUM_LINKS])
+{
+    if (trajectory->numWaypoints == 0)
+    {
+        memset(jointAngles, 0, NUM_LINKS * sizeof(float));
+        return;
+    }
+    uint32_t segment = findSegment(trajectory, time);
+    float coefficients[NUM_LINKS][4];
+    getSegmentCoefficients(trajectory, segment, coefficients);
+    evaluateSegment(coefficients, getSegmentParameter(trajectory, segment, time), jointAngles);
+}
+
+void sampleTrajectoryLinkPoses(const struct Trajectory* trajectory, double time,
+                               struct M3DDualQuaternionf poses[NUM_LINKS])
+{
+    float jointAngles[NUM_LINKS];
+    sampleTrajectory(trajectory, time, jointAngles);
+    computeLinkDualQuaternions(jointAngles, poses);
+}
+
+void initTrajectoryPlayer(struct TrajectoryPlayer* player, const struct Trajectory* trajectory, double tickSeconds)
+{
+    memset(player, 0, sizeof(*player));
+    player->trajectory = trajectory;
+    player->tickSeconds = tickSeconds;
+    player->done = trajectory->numWaypoints == 0;
+    if (!player->done)
+    {
+        player->segment = findSegment(trajectory, 0.0);
+        getSegmentCoefficients(trajectory, player->segment, player->coefficients);
+    }
+}
+
+int stepTrajectoryPlayer(struct TrajectoryPlayer* player, struct KinematicChain* chain)
+{
+    if (player->done)
+        return 0;
+    const struct Trajectory* trajectory = player->trajectory;
+    double time = (double)++player->tick * player->tickSeconds;
+    double duration = getTrajectoryDuration(trajectory);
+    if (time >= duration)
+    {
+        time = duration;
+        player->done = 1;
+    }
+
+    // ticks are usually much shorter than segments, move on one at a time
+    uint32_t segment = player->segment;
+    while (segment + 2 < trajectory->numWaypoints && trajectory->waypoints[segment + 1].time <= time)
+        ++segment;
+    if (segment != player->segment)
+    {
+        player->segment = segment;
+        getSegmentCoefficients(trajectory, segment, player->coefficients);
+    }
+
+    float angles[NUM_LINKS];
+    evaluateSegment(player->coefficients, getSegmentParameter(trajectory, segment, time), angles);
+    for (int j = 1; j < NUM_LINKS; ++j)
+        setJointAngle(chain, j, angles[j]);
+    return !player->done;
+}
+
+uint32_t advanceTrajectoryPlayer(struct TrajectoryPlayer* player, double seconds, uint32_t maxTicks,
+                                 struct KinematicChain* chain)
+{
+    player->pendingSeconds += seconds;
+    uint32_t ticks = 0;
+    while (player->pendingSeconds >= player->tickSeconds && ticks < maxTicks && !player->done)
+    {
+        player->pendingSeconds -= player->tickSeconds;
+        stepTrajectoryPlayer(player, chain);
+        ++ticks;
+    }
+    // falling behind, drop the backlog instead of running ever longer frames
+    if (ticks == maxTicks)
+        player->pendingSeconds = 0.0;
+    return ticks;
+}
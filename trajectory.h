@@ -0,0 +1,77 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <stdint.h>
+#include "kinematics.h"
+
+// Timed joint space waypoints, interpolated with a Catmull-Rom spline per
+// joint. Angles are in degrees and are interpolated as given, so a program
+// that turns a joint past 360 must keep counting instead of wrapping.
+struct TrajectoryWaypoint
+{
+    double time;                        // seconds from the start
+    float jointAngles[NUM_LINKS];       // joint 0 is the fixed base
+};
+
+struct Trajectory
+{
+    uint32_t numWaypoints;
+    struct TrajectoryWaypoint* waypoints;
+};
+
+// Text file, one waypoint per line: time followed by the angles of joints 1
+// to NUM_LINKS - 1. Blank lines and lines starting with '#' are skipped.
+// Times must be strictly increasing. Returns the number of waypoints, 0 on
+// failure.
+uint32_t loadTrajectory(const char* filename, struct Trajectory* trajectory);
+void freeTrajectory(struct Trajectory* trajectory);
+
+inline double getTrajectoryDuration(const struct Trajectory* trajectory)
+{
+    return trajectory->numWaypoints ? trajectory->waypoints[trajectory->numWaypoints - 1].time : 0.0;
+}
+
+// Angles at any time, clamped to the first and last waypoint
+void sampleTrajectory(const struct Trajectory* trajectory, double time, float jointAngles[NUM_LINKS]);
+// Link poses at any time: the joint splines sampled as above, then forward
+// kinematics on dual quaternions. The motion stays defined in joint space;
+// blending link poses directly would pull the links apart.
+void sampleTrajectoryLinkPoses(const struct Trajectory* trajectory, double time,
+                               struct M3DDualQuaternionf poses[NUM_LINKS]);
+
+// Plays a trajectory on a fixed simulation tick, independent of how often
+// it is advanced. Time is the tick count times the tick length, so long
+// runs do not drift. The spline of the current segment is kept in
+// polynomial form; a tick costs one cubic per joint.
+struct TrajectoryPlayer
+{
+    const struct Trajectory* trajectory;
+    double tickSeconds;
+    uint64_t tick;                      // ticks run so far
+    double pendingSeconds;              // wall clock time not yet simulated
+    uint32_t segment;                   // waypoints segment and segment + 1
+    float coefficients[NUM_LINKS][4];   // of the current segment, constant term first
+    int done;
+};
+
+void initTrajectoryPlayer(struct TrajectoryPlayer* player, const struct Trajectory* trajectory, double tickSeconds);
+
+// Runs one tick and writes the new angles to the chain (joints 1 and up).
+// Returns 0 once the end of the trajectory has been reached.
+int stepTrajectoryPlayer(struct TrajectoryPlayer* player, struct KinematicChain* chain);
+
+// Runs as many whole ticks as fit into the time passed since the last call
+// plus what was left over then, at most maxTicks. Returns the number of
+// ticks run.
+uint32_t advanceTrajectoryPlayer(struct TrajectoryPlayer* player, double seconds, uint32_t maxTicks,
+                                 struct KinematicChain* chain);
+
+// The last tick is clamped to the end of the trajectory, and so is this
+inline double getTrajectoryPlayerTime(const struct TrajectoryPlayer* player)
+{
+    double time = player->tick * player->tickSeconds;
+    double duration = getTrajectoryDuration(player->trajectory);
+    return time < duration ? time : duration;
+}
+
+#endif
@@ -0,0 +1,337 @@
+#include "workspace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+
+#define WORKSPACE_EMPTY 0xFFFFFFFFFFFFFFFFULL
+#define WORKSPACE_FIRST_STEPS 4
+// configurations per parallel batch
+#define WORKSPACE_CHUNK 65536
+
+// Scratch buffers of one chunk, joint angles and positions are structure of
+// arrays as computeClawPositionsBatch expects
+struct WorkspaceChunk
+{
+    float* angles[NUM_LINKS - 1];
+    float* base[3];
+    float* tip[3];
+    uint64_t* keys;
+};
+
+static inline uint64_t hashVoxelKey(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static inline uint64_t voxelKey(int32_t x, int32_t y, int32_t z)
+{
+    return ((uint64_t)(x & 0x1FFFFF) << 42) | ((uint64_t)(y & 0x1FFFFF) << 21) | (uint64_t)(z & 0x1FFFFF);
+}
+
+// sign extend the packed 21-bit coordinates
+static inline void voxelCoords(uint64_t key, int32_t v[3])
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        int32_t c = (int32_t)((key >> (42 - 21 * k)) & 0x1FFFFF);
+        v[k] = (c ^ 0x100000) - 0x100000;
+    }
+}
+
+static inline uint64_t positionKey(const struct WorkspaceSampler* sampler, float x, float y, float z)
+{
+    return voxelKey((int32_t)floorf(x / sampler->voxelSize), (int32_t)floorf(y / sampler->voxelSize),
+                    (int32_t)floorf(z / sampler->voxelSize));
+}
+
+static int containsVoxel(const struct WorkspaceSampler* sampler, uint64_t key)
+{
+    uint32_t slot = (uint32_t)hashVoxelKey(key) & sampler->mask;
+    while (sampler->keys[slot] != WORKSPACE_EMPTY)
+    {
+        if (sampler->keys[slot] == key)
+            return 1;
+        slot = (slot + 1) & sampler->mask;
+    }
+    return 0;
+}
+
+static void insertVoxel(uint64_t* keys, uint32_t mask, uint64_t key, uint32_t* count)
+{
+    uint32_t slot = (uint32_t)hashVoxelKey(key) & mask;
+    while (keys[slot] != WORKSPACE_EMPTY)
+    {
+        if (keys[slot] == key)
+            return;
+        slot = (slot + 1) & mask;
+    }
+    keys[slot] = key;
+    (*count)++;
+}
+
+// Keep the table at most half full
+static int growVoxelTable(struct WorkspaceSampler* sampler)
+{
+    uint32_t size = (sampler->mask + 1) * 2;
+    uint64_t* keys = (uint64_t*)malloc(size * sizeof(uint64_t));
+    if (!keys)
+    {
+        perror("Failed to allocate memory");
+        return 0;
+    }
+    memset(keys, 0xFF, size * sizeof(uint64_t));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i <= sampler->mask; ++i)
+    {
+        if (sampler->keys[i] != WORKSPACE_EMPTY)
+            insertVoxel(keys, size - 1, sampler->keys[i], &count);
+    }
+    free(sampler->keys);
+    sampler->keys = keys;
+    sampler->mask = size - 1;
+    return 1;
+}
+
+int initWorkspaceSampler(struct WorkspaceSampler* sampler, float clawLength, float voxelSize, int maxStepsPerJoint)
+{
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->voxelSize = voxelSize;
+    sampler->clawLength = clawLength;
+    sampler->stepsPerJoint = WORKSPACE_FIRST_STEPS;
+    sampler->maxStepsPerJoint = WORKSPACE_FIRST_STEPS;
+    while (sampler->maxStepsPerJoint < maxStepsPerJoint)
+        sampler->maxStepsPerJoint *= 2;
+
+    // the last joint cannot move the tip when it turns about the claw itself
+    for (int j = 1; j < NUM_LINKS; ++j)
+    {
+        const float* axis = linkRotateAxis[j];
+        if (j == NUM_LINKS - 1 && axis[0] == 0.0f && axis[2] == 0.0f)
+            continue;
+        sampler->activeJoints[sampler->numActiveJoints++] = j - 1;
+    }
+
+    sampler->mask = 4096 - 1;
+    sampler->keys = (uint64_t*)malloc((sampler->mask + 1) * sizeof(uint64_t));
+    if (!sampler->keys)
+    {
+        perror("Failed to allocate memory");
+        return 0;
+    }
+    memset(sampler->keys, 0xFF, (sampler->mask + 1) * sizeof(uint64_t));
+    return 1;
+}
+
+void freeWorkspaceSampler(struct WorkspaceSampler* sampler)
+{
+    free(sampler->keys);
+    memset(sampler, 0, sizeof(*sampler));
+}
+
+// Fill the chunk with the next configurations of the current level. Sample
+// n has one base-steps digit per active joint; at levels after the first,
+// samples with only even digits were visited before and are skipped.
+static size_t fillChunk(struct WorkspaceSampler* sampler, struct WorkspaceChunk* chunk, uint64_t levelSize)
+{
+    int shift = 0;
+    while ((1 << shift) < sampler->stepsPerJoint)
+        shift++;
+    uint64_t digitMask = (uint64_t)sampler->stepsPerJoint - 1;
+    float stepAngle = 360.0f / sampler->stepsPerJoint;
+    bool skipEven = sampler->stepsPerJoint > WORKSPACE_FIRST_STEPS;
+
+    size_t n = 0;
+    while (n < WORKSPACE_CHUNK && sampler->nextSample < levelSize)
+    {
+        uint64_t sample = sampler->nextSample++;
+        bool allEven = true;
+        for (int j = 0; j < sampler->numActiveJoints; ++j)
+            allEven = allEven && (((sample >> (j * shift)) & 1) == 0);
+        if (skipEven && allEven)
+            continue;
+        for (int j = 0; j < sampler->numActiveJoints; ++j)
+            chunk->angles[sampler->activeJoints[j]][n] = ((sample >> (j * shift)) & digitMask) * stepAngle;
+        n++;
+    }
+    return n;
+}
+
+int stepWorkspaceSampler(struct WorkspaceSampler* sampler, double seconds)
+{
+    if (sampler->done)
+        return 0;
+
+    struct WorkspaceChunk chunk;
+    float* buffer = (float*)calloc((size_t)WORKSPACE_CHUNK * (NUM_LINKS - 1 + 6), sizeof(float));
+    chunk.keys = (uint64_t*)malloc(WORKSPACE_CHUNK * sizeof(uint64_t));
+    if (!buffer || !chunk.keys)
+    {
+        perror("Failed to allocate memory");
+        free(buffer);
+        free(chunk.keys);
+        return -1;
+    }
+    for (int j = 0; j < NUM_LINKS - 1; ++j)
+        chunk.angles[j] = buffer + (size_t)j * WORKSPACE_CHUNK;
+    for (int k = 0; k < 3; ++k)
+    {
+        chunk.base[k] = buffer + (size_t)(NUM_LINKS - 1 + k) * WORKSPACE_CHUNK;
+        chunk.tip[k] = buffer + (size_t)(NUM_LINKS + 2 + k) * WORKSPACE_CHUNK;
+    }
+
+    uint32_t numVoxels = sampler->numVoxels;
+    int failed = 0;
+    double start = omp_get_wtime();
+    do
+    {
+        uint64_t levelSize = 1;
+        for (int j = 0; j < sampler->numActiveJoints; ++j)
+            levelSize *= sampler->stepsPerJoint;
+        size_t n = fillChunk(sampler, &chunk, levelSize);
+
+        // forward kinematics and voxel keys in parallel, blocks stay a
+        // multiple of 4 for the SIMD path
+        #pragma omp parallel for schedule(static)
+        for (int64_t first = 0; first < (int64_t)n; first += 4096)
+        {
+            size_t count = (n - first < 4096) ? n - first : 4096;
+            const float* angles[NUM_LINKS - 1];
+            float* base[3];
+            float* tip[3];
+            for (int j = 0; j < NUM_LINKS - 1; ++j)
+                angles[j] = chunk.angles[j] + first;
+            for (int k = 0; k < 3; ++k)
+            {
+                base[k] = chunk.base[k] + first;
+                tip[k] = chunk.tip[k] + first;
+            }
+            computeClawPositionsBatch(angles, count, sampler->clawLength, base, tip);
+            for (size_t i = first; i < first + count; ++i)
+                chunk.keys[i] = positionKey(sampler, chunk.tip[0][i], chunk.tip[1][i], chunk.tip[2][i]);
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if ((sampler->numVoxels + 1) * 2 > sampler->mask + 1 && !growVoxelTable(sampler))
+            {
+                // nextSample is already past this chunk, the rest would be lost
+                failed = 1;
+                break;
+            }
+            insertVoxel(sampler->keys, sampler->mask, chunk.keys[i], &sampler->numVoxels);
+        }
+        if (failed)
+            break;
+        sampler->numSamples += n;
+
+        if (sampler->nextSample == levelSize)
+        {
+            if (sampler->stepsPerJoint >= sampler->maxStepsPerJoint)
+                sampler->done = 1;
+            else
+                sampler->stepsPerJoint *= 2;
+            sampler->nextSample = 0;
+        }
+    } while (!sampler->done && omp_get_wtime() - start < seconds);
+
+    free(buffer);
+    free(chunk.keys);
+
+    if (failed)
+        return -1;
+    if (sampler->numVoxels == numVoxels)
+        return 0;
+    sampler->version++;
+    return 1;
+}
+
+int isWorkspaceVoxelOccupied(const struct WorkspaceSampler* sampler, const float position[3])
+{
+    return containsVoxel(sampler, positionKey(sampler, position[0], position[1], position[2]));
+}
+
+uint32_t getWorkspaceVoxels(const struct WorkspaceSampler* sampler, int32_t* voxels)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i <= sampler->mask; ++i)
+    {
+        if (sampler->keys[i] == WORKSPACE_EMPTY)
+            continue;
+        voxelCoords(sampler->keys[i], &voxels[n * 3]);
+        n++;
+    }
+    return n;
+}
+
+// Corners of each voxel face in voxel units, counter-clockwise seen from
+// outside, and the neighbour the face looks at
+static const int8_t faceNeighbours[6][3] = {
+    { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+};
+static const int8_t faceCorners[6][4][3] = {
+    { {1, 0, 0}, {1, 1, 0}, {1, 1, 1}, {1, 0, 1} },
+    { {0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0} },
+    { {0, 1, 0}, {0, 1, 1}, {1, 1, 1}, {1, 1, 0} },
+    { {0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1} },
+    { {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1} },
+    { {0, 0, 0}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0} }
+};
+
+uint32_t buildWorkspaceEnvelope(const struct WorkspaceSampler* sampler, float** vertices)
+{
+    *vertices = NULL;
+    // count first so the array is allocated once
+    uint32_t numFaces = 0;
+    for (uint32_t i = 0; i <= sampler->mask; ++i)
+    {
+        uint64_t key = sampler->keys[i];
+        if (key == WORKSPACE_EMPTY)
+            continue;
+        int32_t v[3];
+        voxelCoords(key, v);
+        for (int f = 0; f < 6; ++f)
+        {
+            if (!containsVoxel(sampler, voxelKey(v[0] + faceNeighbours[f][0], v[1] + faceNeighbours[f][1],
+                                                 v[2] + faceNeighbours[f][2])))
+                numFaces++;
+        }
+    }
+    if (numFaces == 0)
+        return 0;
+
+    float* out = (float*)malloc((size_t)numFaces * 4 * 6 * sizeof(float));
+    if (!out)
+    {
+        perror("Failed to allocate memory");
+        return 0;
+    }
+    *vertices = out;
+    for (uint32_t i = 0; i <= sampler->mask; ++i)
+    {
+        uint64_t key = sampler->keys[i];
+        if (key == WORKSPACE_EMPTY)
+            continue;
+        int32_t v[3];
+        voxelCoords(key, v);
+        for (int f = 0; f < 6; ++f)
+        {
+            if (containsVoxel(sampler, voxelKey(v[0] + faceNeighbours[f][0], v[1] + faceNeighbours[f][1],
+                                                v[2] + faceNeighbours[f][2])))
+                continue;
+            for (int c = 0; c < 4; ++c)
+            {
+                for (int k = 0; k < 3; ++k)
+                    *out++ = (v[k] + faceCorners[f][c][k]) * sampler->voxelSize;
+                for (int k = 0; k < 3; ++k)
+                    *out++ = faceNeighbours[f][k];
+            }
+        }
+    }
+    return numFaces * 4;
+}
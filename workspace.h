@@ -0,0 +1,52 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "kinematics.h"
+
+// Claw tip positions reachable by sweeping the joints, recorded in a sparse
+// voxel grid (hash set of occupied voxels) in arm base coordinates.
+// Sampling is progressive: each level doubles the number of steps per joint
+// and only visits configurations the previous levels did not, so a coarse
+// envelope is available after the first few milliseconds.
+struct WorkspaceSampler
+{
+    float voxelSize;
+    float clawLength;
+    int activeJoints[NUM_LINKS - 1];    // joints that can move the tip
+    int numActiveJoints;
+
+    int stepsPerJoint;                  // current level
+    int maxStepsPerJoint;
+    uint64_t nextSample;                // within the current level
+    uint64_t numSamples;                // total so far
+    int done;
+
+    uint32_t numVoxels;
+    uint32_t mask;                      // table size - 1
+    uint64_t* keys;                     // packed voxel coordinates, WORKSPACE_EMPTY if free
+    uint32_t version;                   // bumped whenever voxels are added
+};
+
+// maxStepsPerJoint is rounded up to a power of two. Returns 0 on allocation
+// failure.
+int initWorkspaceSampler(struct WorkspaceSampler* sampler, float clawLength, float voxelSize, int maxStepsPerJoint);
+void freeWorkspaceSampler(struct WorkspaceSampler* sampler);
+
+// Sample for roughly the given time, in parallel (OpenMP). Returns 1 if new
+// voxels were found, 0 if not (done is set once every level has been
+// sampled), -1 on allocation failure.
+int stepWorkspaceSampler(struct WorkspaceSampler* sampler, double seconds);
+
+int isWorkspaceVoxelOccupied(const struct WorkspaceSampler* sampler, const float position[3]);
+// Writes the coordinates (in voxels) of every occupied voxel, 3 per voxel;
+// voxels must hold numVoxels * 3 entries. Returns the number of voxels.
+uint32_t getWorkspaceVoxels(const struct WorkspaceSampler* sampler, int32_t* voxels);
+
+// Outer faces of the occupied voxels as quads, 6 floats per vertex
+// (position, normal). Returns the number of vertices; *vertices is
+// allocated with malloc.
+uint32_t buildWorkspaceEnvelope(const struct WorkspaceSampler* sampler, float** vertices);
+
+#endif